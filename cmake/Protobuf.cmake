@@ -46,12 +46,16 @@ function(PROTOBUF_GENERATE_CPP_QT OUTPUT)
 
     set(protoc_plugin ${CMAKE_BINARY_DIR}/protoc-gen-cpp_qt/protoc-gen-cpp_qt)
 
+    # Most strings in large responses are never read, so only convert them to
+    # QStrings when they are.
+    set(protoc_options lazy_strings)
+
     add_custom_command(
       OUTPUT "${CMAKE_CURRENT_BINARY_DIR}/${FIL_WE}.pb.cc"
              "${CMAKE_CURRENT_BINARY_DIR}/${FIL_WE}.pb.h"
       COMMAND  ${PROTOBUF_PROTOC_EXECUTABLE}
       ARGS --plugin=protoc-gen-cpp_qt=${protoc_plugin}
-           --cpp_qt_out ${CMAKE_CURRENT_BINARY_DIR}
+           --cpp_qt_out ${protoc_options}:${CMAKE_CURRENT_BINARY_DIR}
            --proto_path ${PATH}
            ${ABS_FIL}
       DEPENDS ${ABS_FIL}
@@ -6,16 +6,22 @@
 Entry point for the pyqtc worker.
 """
 
+import contextlib
 import logging
 import os
 import rope.base.project
-from rope.base import worder
+from rope.base import exceptions, taskhandle, worder
 from rope.contrib import codeassist
 import sys
 
+# This has to happen before any protobufs are imported.
+import protoencoding
+protoencoding.UseFastestImplementation()
+
 import messagehandler
 import rpc_pb2
 import symbolindex
+import zygote
 
 
 class ProjectNotFoundError(Exception):
@@ -34,6 +40,20 @@ class Project(object):
     self.symbol_index = symbolindex.SymbolIndex(rope_project)
 
 
+class IdleTaskHandle(taskhandle.DeadlineTaskHandle):
+  """
+  A rope task handle that stops the task when a request arrives or when its
+  time budget runs out.
+  """
+
+  def __init__(self, is_interrupted, budget):
+    super(IdleTaskHandle, self).__init__("Idle", budget)
+    self.is_interrupted = is_interrupted
+
+  def is_stopped(self):
+    return super(IdleTaskHandle, self).is_stopped() or self.is_interrupted()
+
+
 class Handler(messagehandler.MessageHandler):
   """
   Handles rpc requests.
@@ -58,18 +78,43 @@ class Handler(messagehandler.MessageHandler):
 
   MAXFIXES = 10
 
+  # Seconds of static object analysis to do each time the worker is idle.
+  IDLE_SOA_BUDGET = 1.0
+
+  PROTOCOL_VERSION    = rpc_pb2.PROTOCOL_VERSION_3
+  FEATURES            = rpc_pb2.FEATURE_COMPRESSION
+  COMPRESSION_FEATURE = rpc_pb2.FEATURE_COMPRESSION
+
+  # Files to index between partial responses to a rebuild.
+  REBUILD_PROGRESS_INTERVAL = 100
+
   def __init__(self):
     super(Handler, self).__init__(rpc_pb2.Message)
 
     self.projects = {}
 
+    # Building big responses out of pure Python protobufs is slow, so they're
+    # encoded by hand unless the C++ implementation is available.
+    self.encode_responses = protoencoding.IsPurePython()
+
   def CreateProjectRequest(self, request, _response):
     """
     Creates a new rope project and stores it away for later.
     """
 
     root = os.path.normpath(request.project_root)
-    project = rope.base.project.Project(root)
+
+    # Another worker saves the object database, history and file list of read
+    # only projects.
+    prefs = {}
+    if request.read_only:
+      prefs["save_objectdb"] = False
+      prefs["save_history"]  = False
+      prefs["save_filelist"] = False
+
+    # Modules changed by rope are analyzed while the worker is idle instead of
+    # during whichever request notices the change.
+    project = rope.base.project.Project(root, deferred_soa=True, **prefs)
 
     self.projects[root] = Project(project)
   
@@ -84,6 +129,24 @@ class Handler(messagehandler.MessageHandler):
     project.rope_project.close()
     del self.projects[root]
 
+  def HasIdleWork(self):
+    return any(project.rope_project.pycore.has_deferred_soa()
+               for project in self.projects.values())
+
+  def Idle(self, is_interrupted):
+    """
+    Does static object analysis on changed modules in the background.  The
+    results are written to the object database where later requests find them.
+    """
+
+    task_handle = IdleTaskHandle(is_interrupted, self.IDLE_SOA_BUDGET)
+
+    for project in self.projects.values():
+      try:
+        project.rope_project.pycore.perform_deferred_soa(task_handle)
+      except exceptions.InterruptedTaskError:
+        return
+
   def _Context(self, context):
     """
     Returns a (project, resource, source, offset) tuple for the context.
@@ -100,6 +163,50 @@ class Handler(messagehandler.MessageHandler):
       context.cursor_position,
     )
   
+  @contextlib.contextmanager
+  def _TimeBudget(self, project, context):
+    """
+    Makes rope give up inferring objects when the context's time budget runs
+    out.  Anything rope concluded after that might be incomplete, so the
+    modules it concluded things about during the request forget them again
+    afterwards.
+    """
+
+    if not context.time_budget_msec:
+      yield
+      return
+
+    pycore = project.pycore
+    pycore.inference_handle = taskhandle.DeadlineTaskHandle(
+        "Request", context.time_budget_msec / 1000.0)
+    try:
+      yield
+    finally:
+      if pycore.inference_stopped():
+        for pymodule in pycore.inference_touched_modules:
+          pymodule._forget_concluded_data()
+      pycore.inference_touched_modules.clear()
+      pycore.inference_handle = None
+
+  @staticmethod
+  @contextlib.contextmanager
+  def _SharedAnalysis(project):
+    """
+    Makes rope reuse the module it analyses for a source until the end of the
+    block, instead of analysing it again for each request.
+    """
+
+    if project is None:
+      yield
+      return
+
+    pycore = project.pycore
+    pycore.string_module_cache = {}
+    try:
+      yield
+    finally:
+      pycore.string_module_cache = None
+
   def _ProjectForFile(self, file_path):
     """
     Tries to find the project that contains the given file.
@@ -124,50 +231,60 @@ class Handler(messagehandler.MessageHandler):
     # Get information out of the request
     project, resource, source, offset = self._Context(request.context)
 
-    # If the cursor is immediately after a comma or open paren, we should look
-    # for a calltip first.
-    word_finder = worder.Worder(source)
-    non_space_offset = word_finder.code_finder._find_last_non_space_char(offset)
-
-    if word_finder.code_finder.code[non_space_offset] in "(,":
-      paren_start = word_finder.find_parens_start_from_inside(offset)
-
-      # Get a calltip now
-      calltip = codeassist.get_calltip(project, source, paren_start-1,
-                                       maxfixes=self.MAXFIXES,
-                                       resource=resource,
-                                       remove_self=True)
-      
-      if calltip is not None:
-        response.insertion_position = paren_start + 1
-        response.calltip = calltip
+    with self._TimeBudget(project, request.context):
+      # If the cursor is immediately after a comma or open paren, we should look
+      # for a calltip first.
+      word_finder = worder.Worder(source)
+      non_space_offset = \
+          word_finder.code_finder._find_last_non_space_char(offset)
+
+      if word_finder.code_finder.code[non_space_offset] in "(,":
+        paren_start = word_finder.find_parens_start_from_inside(offset)
+
+        # Get a calltip now
+        calltip = codeassist.get_calltip(project, source, paren_start-1,
+                                         maxfixes=self.MAXFIXES,
+                                         resource=resource,
+                                         remove_self=True)
+
+        if calltip is not None:
+          response.insertion_position = paren_start + 1
+          response.calltip = calltip
+          return
+
+      # Do normal completion if a calltip couldn't be found
+      proposals = codeassist.code_assist(project, source, offset,
+                                         maxfixes=self.MAXFIXES,
+                                         resource=resource)
+      proposals = codeassist.sorted_proposals(proposals)
+
+      # Get the position that this completion will start from.
+      starting_offset = codeassist.starting_offset(source, offset)
+      response.insertion_position = starting_offset
+
+      proposals = [(proposal.name,
+                    self.PROPOSAL_TYPES.get(proposal.type),
+                    self.PROPOSAL_SCOPES.get(proposal.scope),
+                    proposal.get_doc())
+                   for proposal in proposals]
+
+      if self.encode_responses and self.SetEncodedField("completion_response",
+          protoencoding.EncodeCompletionResponse(proposals, starting_offset)):
         return
-    
-    # Do normal completion if a calltip couldn't be found
-    proposals = codeassist.code_assist(project, source, offset,
-                                       maxfixes=self.MAXFIXES,
-                                       resource=resource)
-    proposals = codeassist.sorted_proposals(proposals)
-
-    # Get the position that this completion will start from.
-    starting_offset = codeassist.starting_offset(source, offset)
-    response.insertion_position = starting_offset
-    
-    # Construct the response protobuf
-    for proposal in proposals:
-      proposal_pb = response.proposal.add()
-      proposal_pb.name = proposal.name
 
-      docstring = proposal.get_doc()
+      # Construct the response protobuf
+      for name, proposal_type, scope, docstring in proposals:
+        proposal_pb = response.proposal.add()
+        proposal_pb.name = name
 
-      if proposal.type in self.PROPOSAL_TYPES:
-        proposal_pb.type = self.PROPOSAL_TYPES[proposal.type]
+        if proposal_type is not None:
+          proposal_pb.type = proposal_type
 
-      if proposal.scope in self.PROPOSAL_SCOPES:
-        proposal_pb.scope = self.PROPOSAL_SCOPES[proposal.scope]
+        if scope is not None:
+          proposal_pb.scope = scope
 
-      if docstring is not None:
-        proposal_pb.docstring = docstring
+        if docstring is not None:
+          proposal_pb.docstring = docstring
   
   def TooltipRequest(self, request, response):
     """
@@ -197,13 +314,22 @@ class Handler(messagehandler.MessageHandler):
     if offset is not None:
       response.line = offset
   
-  def RebuildSymbolIndexRequest(self, request, _response):
+  def RebuildSymbolIndexRequest(self, request, response):
     """
     Parses all the files in the project and rebuilds the symbol index.
     """
 
+    def Progress(indexed_file_count, file_count):
+      if indexed_file_count % self.REBUILD_PROGRESS_INTERVAL == 0:
+        response.indexed_file_count = indexed_file_count
+        response.file_count         = file_count
+        self.SendPartialResponse(response)
+
     project = self.projects[request.project_root]
-    project.symbol_index.Rebuild()
+    file_count = project.symbol_index.Rebuild(Progress)
+
+    response.indexed_file_count = file_count
+    response.file_count         = file_count
   
   def UpdateSymbolIndexRequest(self, request, _response):
     """
@@ -229,8 +355,13 @@ class Handler(messagehandler.MessageHandler):
       projects = [self._ProjectForFile(request.file_path)]
     else:
       projects = self.projects.values()
-    
-    for project in projects:
+
+    for i, project in enumerate(projects):
+      if i > 0:
+        # The requester can read the earlier projects' results while this one
+        # is searched.
+        self.SendPartialResponse(response)
+
       project_dir = project.rope_project.address
 
       file_path = None
@@ -248,26 +379,114 @@ class Handler(messagehandler.MessageHandler):
       results = project.symbol_index.Search(request.query,
           file_path=file_path, symbol_type=symbol_type)
       
-      # Create the response
+      found = []
       for module_name, file_path, line_number, symbol_name, symbol_type in results:
-        result_pb = response.result.add()
+        found.append((module_name, os.path.join(project_dir, file_path),
+                      line_number, symbol_name, symbol_type))
+
+      self._AddSearchResults(response, found)
+
+  def _AddSearchResults(self, response, found):
+    """
+    Adds a list of (module_name, file_path, line_number, symbol_name,
+    symbol_type) tuples to the SearchResponse.
+    """
+
+    if self.encode_responses and self.SetEncodedField("search_response",
+        protoencoding.EncodeSearchResponse(found)):
+      return
+
+    for module_name, file_path, line_number, symbol_name, symbol_type in found:
+      result_pb = response.result.add()
+
+      result_pb.module_name = module_name
+      result_pb.file_path   = file_path
+      result_pb.line_number = line_number
+      result_pb.symbol_name = symbol_name
+      result_pb.symbol_type = symbol_type
+
+  def BatchRequest(self, request, response):
+    """
+    Handles each request in the batch in turn.  The requests share the
+    batch's context and the analysis of its source.
+    """
+
+    project = None
+    if request.HasField("context"):
+      project = self._ProjectForFile(request.context.file_path).rope_project
+
+    with self._SharedAnalysis(project):
+      for sub_request in request.request:
+        if request.HasField("context"):
+          self._FillContext(sub_request, request.context)
+
+        sub_response = response.response.add()
+        sub_response.id = sub_request.id
+        self.HandleRequest(sub_request, sub_response)
+
+  @staticmethod
+  def _FillContext(message, context):
+    """
+    Sets the fields that aren't set in the context of the request in the
+    message to the ones in the given context.
+    """
+
+    for _descriptor, request_pb in message.ListFields():
+      own_context = getattr(request_pb, "context", None)
+      if own_context is None:
+        continue
+
+      merged = rpc_pb2.Context()
+      merged.CopyFrom(context)
+      merged.MergeFrom(own_context)
+      own_context.CopyFrom(merged)
+
+  def HeartbeatRequest(self, _request, _response):
+    """
+    Does nothing.  The plugin restarts the worker if this doesn't respond in
+    time.
+    """
+
+    pass
+
+  def MemoryStatsRequest(self, request, response):
+    """
+    Reports the size of the object database of one or all projects.
+    """
+
+    if request.HasField("project_root"):
+      roots = [os.path.normpath(request.project_root)]
+    else:
+      roots = self.projects.keys()
+
+    for root in roots:
+      stats = self.projects[root].rope_project.pycore.object_info.get_stats()
 
-        result_pb.module_name = module_name
-        result_pb.file_path   = os.path.join(project_dir, file_path)
-        result_pb.line_number = line_number
-        result_pb.symbol_name = symbol_name
-        result_pb.symbol_type = symbol_type
+      project_pb = response.project.add()
+      project_pb.project_root      = root
+      project_pb.file_count        = stats.get("files", 0)
+      project_pb.loaded_file_count = stats.get("loaded_files", 0)
+      project_pb.scope_count       = stats.get("scopes", 0)
+      project_pb.call_info_count   = stats.get("call_infos", 0)
+      project_pb.per_name_count    = stats.get("per_names", 0)
+      project_pb.stored_size       = stats.get("stored_size", 0)
 
 
 def Main(args):
   """
   Connects to the socket passed on the commandline and listens for requests.
+  With --zygote, forks a worker for each socket named on stdin instead.
   """
 
   logging.basicConfig()
 
-  handler = Handler()
-  handler.ServeForever(args[0])
+  if args[0] == "--zygote":
+    forker = zygote.Zygote(Handler)
+    forker.Warm()
+    forker.ServeForever(sys.stdin)
+  else:
+    handler = Handler()
+    handler.ServeForever(args[0])
 
 
 if __name__ == "__main__":
@@ -5,9 +5,14 @@ responses to stdout.
 
 import logging
 import re
+import select
 import socket
 import struct
 import sys
+import time
+import zlib
+
+import protoencoding
 
 class ShortReadError(Exception):
   """
@@ -28,13 +33,47 @@ class UnknownRequestType(Exception):
 class MessageHandler(object):
   """
   Abstract subclass for handling messages and sending responses.  Your subclass
-  should implement a method for each request you want to handle.  The fields in
-  the request protobuf are searched for a field ending with "_request".  That
-  field name is converted to CamelCase and the method with that name is called
-  on this class.
+  should implement a method for each request you want to handle.  Each field in
+  the message ending with "_request" is converted to CamelCase, and the method
+  with that name is called on this class to handle requests with that field
+  set.  The methods are looked up once, when the handler is created.
+
+  If the message has a "method" field and it's set in a request, it's the
+  number of the request's field and the handler is found without looking at
+  the other fields.  Otherwise the first x_request field that is set is used.
+
+  Subclasses can also do work in the background while no requests are waiting
+  by implementing HasIdleWork and Idle.
+
+  If the message has worker_started_usec and worker_finished_usec fields they
+  are set on each response to the times the request was handled.
+
+  If the message has accept_partial and partial fields, handlers can send
+  results early with SendPartialResponse to requesters that accept them.
+
+  Handlers can send a response field they've serialised themselves with
+  SetEncodedField.
+
+  Requesters start with a handshake, handled by HelloRequest, that agrees on
+  the features both ends support.  Subclasses set PROTOCOL_VERSION and
+  FEATURES to what they support.  If COMPRESSION_FEATURE is agreed on, large
+  responses are compressed.  Compressed messages are always read.
   """
 
-  handlers = None
+  # Seconds without any requests before Idle is called.
+  IDLE_DELAY = 0.5
+
+  # The top bit of a message's length is set if it's compressed.  The data is
+  # in the format Qt's qCompress uses - the uncompressed length followed by a
+  # zlib stream.
+  COMPRESSED_FLAG       = 0x80000000
+  COMPRESSION_THRESHOLD = 16 * 1024
+  COMPRESSION_LEVEL     = 1
+  COMPRESSION_FEATURE   = None
+
+  # The newest protocol version and the features this end supports.
+  PROTOCOL_VERSION = None
+  FEATURES         = 0
 
   UNDER_LETTER    = re.compile(r'_([a-z])')
   REQUEST_SUFFIX  = "_request"
@@ -43,6 +82,45 @@ class MessageHandler(object):
   def __init__(self, message_class):
     self.message_class = message_class
 
+    fields = message_class.DESCRIPTOR.fields_by_name
+    self.record_times = ("worker_started_usec" in fields and
+                         "worker_finished_usec" in fields)
+    self.has_method = "method" in fields
+    self.has_partial = "accept_partial" in fields and "partial" in fields
+
+    # The features both ends support, once the requester has sent its hello.
+    self.features = 0
+
+    # Whether WriteMessage compresses large messages.
+    self.compress = False
+
+    # An (output handle, response) tuple while handling a request that
+    # accepts partial responses.
+    self.partial_target = None
+
+    # Serialised fields to send after the response, or None while handling a
+    # request that's part of a batch.
+    self.encoded_fields = None
+
+    # Maps the number of each x_request field to a (function, request field
+    # name, response field name) tuple.  function is None if this class
+    # doesn't handle that request.
+    self.dispatch_table = {}
+
+    for field in message_class.DESCRIPTOR.fields:
+      name = field.name
+      if not name.endswith(self.REQUEST_SUFFIX):
+        continue
+
+      # Convert some_thing_request to SomeThingRequest
+      func_name = name[0].upper() + name[1:]
+      func_name = self.UNDER_LETTER.sub(lambda m: m.group(1).upper(), func_name)
+
+      response_name = name[:-len(self.REQUEST_SUFFIX)] + self.RESPONSE_SUFFIX
+
+      self.dispatch_table[field.number] = (
+        getattr(self, func_name, None), name, response_name)
+
   def ReadMessage(self, handle):
     """
     Reads a uint32 length-encoded protobuf from the file handle and returns it.
@@ -55,22 +133,34 @@ class MessageHandler(object):
 
     # Decode the length
     (length,) = struct.unpack(">I", encoded_length)
+    compressed = length & self.COMPRESSED_FLAG
+    length &= ~self.COMPRESSED_FLAG
 
     # Read the protobuf
     data = handle.read(length)
     if len(data) != length:
       raise ShortReadError()
 
+    if compressed:
+      data = zlib.decompress(data[4:])
+
     return self.message_class.FromString(data)
 
-  @staticmethod
-  def WriteMessage(handle, message):
+  def WriteMessage(self, handle, message, encoded_fields=""):
     """
     uint32 length-encodes the given protobuf and writes it to the file handle.
+    encoded_fields are serialised fields to append to the message.
     """
 
-    data = message.SerializeToString()
-    handle.write(struct.pack(">I", len(data)) + data)
+    data = message.SerializeToString() + encoded_fields
+    length = len(data)
+
+    if self.compress and length > self.COMPRESSION_THRESHOLD:
+      data = struct.pack(">I", length) + \
+             zlib.compress(data, self.COMPRESSION_LEVEL)
+      length = len(data) | self.COMPRESSED_FLAG
+
+    handle.write(struct.pack(">I", length) + data)
     handle.flush()
 
   def FunctionForRequest(self, request, response):
@@ -84,29 +174,153 @@ class MessageHandler(object):
     parent messages.
     """
 
+    if self.has_method and request.HasField("method"):
+      try:
+        entry = self.dispatch_table[request.method]
+      except KeyError:
+        raise UnknownRequestType(request.method)
+      return self._Dispatch(entry, request, response)
+
+    # Requests from older senders don't say which field is set.
     for descriptor, _value in request.ListFields():
-      name = descriptor.name
-      if not name.endswith(self.REQUEST_SUFFIX):
-        continue
-      
-      # Convert some_thing_request to SomeThingRequest
-      func_name = name[0].upper() + name[1:]
-      func_name = self.UNDER_LETTER.sub(lambda m: m.group(1).upper(), func_name)
-      
       try:
-        function = getattr(self, func_name)
-      except AttributeError:
-        raise UnknownRequestType(name)
+        entry = self.dispatch_table[descriptor.number]
+      except KeyError:
+        continue
+      return self._Dispatch(entry, request, response)
 
-      response_name = name[:-len(self.REQUEST_SUFFIX)] + self.RESPONSE_SUFFIX
+    raise UnknownRequestType
 
-      # Get the nested messages
-      request_pb  = getattr(request, name)
-      response_pb = getattr(response, response_name)
+  @staticmethod
+  def _Dispatch(entry, request, response):
+    """
+    Returns the (function, request_pb, response_pb) tuple for an entry in the
+    dispatch table.
+    """
 
-      return (function, request_pb, response_pb)
-    
-    raise UnknownRequestType
+    function, name, response_name = entry
+    if function is None:
+      raise UnknownRequestType(name)
+
+    # Get the nested messages
+    return (function, getattr(request, name), getattr(response, response_name))
+
+  def HandleRequest(self, request, response, output_handle=None):
+    """
+    Finds a function to handle the request and calls it.  If that fails the
+    error is put in the response's error_response field.  Partial responses
+    are written to output_handle if it's given and the request accepts them.
+
+    Returns the fields the handler encoded with SetEncodedField, which must be
+    sent after the response.  Handlers can only do that if output_handle is
+    given.
+    """
+
+    previous_target = self.partial_target
+    previous_fields = self.encoded_fields
+
+    if output_handle is not None and self.has_partial and \
+        request.accept_partial:
+      self.partial_target = (output_handle, response)
+    else:
+      self.partial_target = None
+
+    self.encoded_fields = [] if output_handle is not None else None
+
+    try:
+      function, request_pb, response_pb = \
+          self.FunctionForRequest(request, response)
+      function(request_pb, response_pb)
+      return "".join(self.encoded_fields or [])
+    except Exception, ex:
+      logging.exception("Error handling request %s", request)
+      response.error_response.message = \
+        "%s: %s" % (ex.__class__.__name__, str(ex))
+      return ""
+    finally:
+      self.partial_target = previous_target
+      self.encoded_fields = previous_fields
+
+  def SetEncodedField(self, name, data):
+    """
+    Sends data as the serialised contents of the named message field of the
+    response.  Returns False if that isn't possible because the request is
+    part of a batch - the handler must fill in the response instead.
+    """
+
+    if self.encoded_fields is None:
+      return False
+
+    number = self.message_class.DESCRIPTOR.fields_by_name[name].number
+    self.encoded_fields.append(protoencoding.EncodeLengthDelimited(number, data))
+    return True
+
+  def SendPartialResponse(self, response_pb):
+    """
+    Sends what the handler has put in response_pb so far in a partial response
+    and clears it, along with any fields set with SetEncodedField.  Does
+    nothing if the request doesn't accept partial responses, so everything is
+    sent in the last response instead.
+    """
+
+    if self.partial_target is None:
+      return
+
+    output_handle, response = self.partial_target
+    response.partial = True
+    self.WriteMessage(output_handle, response, "".join(self.encoded_fields))
+
+    response.ClearField("partial")
+    del self.encoded_fields[:]
+    response_pb.Clear()
+    response_pb.SetInParent()
+
+  def HelloRequest(self, request, response):
+    """
+    Tells the requester which protocol version and features we support, and
+    starts using the features we both support.
+    """
+
+    if self.PROTOCOL_VERSION is not None:
+      response.version = self.PROTOCOL_VERSION
+    response.features = self.FEATURES
+
+    self.features = request.features & self.FEATURES
+    self.compress = self.COMPRESSION_FEATURE is not None and \
+                    bool(self.features & self.COMPRESSION_FEATURE)
+
+  def HasIdleWork(self):
+    """
+    Returns True if Idle should be called when no requests are waiting.
+    """
+
+    return False
+
+  def Idle(self, is_interrupted):
+    """
+    Does some background work.  is_interrupted is a function that returns True
+    when a request has arrived - the work should stop as soon as possible when
+    it does.
+    """
+
+    pass
+
+  @staticmethod
+  def _TimeUsec():
+    """
+    Returns the current wall-clock time in microseconds since the epoch.
+    """
+
+    return int(time.time() * 1000000)
+
+  @staticmethod
+  def _IsReadable(sock, timeout):
+    """
+    Returns True if data can be read from the socket within timeout seconds.
+    """
+
+    readable, _, _ = select.select([sock], [], [], timeout)
+    return bool(readable)
 
   def ServeForever(self, socket_filename):
     """
@@ -119,13 +333,25 @@ class MessageHandler(object):
     sock.connect(socket_filename)
 
     input_handle = output_handle = sock.makefile()
+    is_interrupted = lambda: self._IsReadable(sock, 0)
 
     while True:
+      # Do background work until the next request arrives.  ReadMessage never
+      # reads past the end of a message, so anything not yet handled is still
+      # waiting on the socket.
+      while self.HasIdleWork() and not self._IsReadable(sock, self.IDLE_DELAY):
+        try:
+          self.Idle(is_interrupted)
+        except Exception:
+          logging.exception("Error doing idle work")
+
       try:
         request = self.ReadMessage(input_handle)
       except ShortReadError:
         break
 
+      started_usec = self._TimeUsec()
+
       print >> sys.stderr, ">" * 80
       print >> sys.stderr, request
 
@@ -133,17 +359,13 @@ class MessageHandler(object):
       response = self.message_class()
       response.id = request.id
 
-      try:
-        # Find a function to handle the request and call it
-        function, request_pb, response_pb = \
-            self.FunctionForRequest(request, response)
-        function(request_pb, response_pb)
-      except Exception, ex:
-        logging.exception("Error handling request %s", request)
-        response.error_response.message = \
-          "%s: %s" % (ex.__class__.__name__, str(ex))
+      encoded_fields = self.HandleRequest(request, response, output_handle)
+
+      if self.record_times:
+        response.worker_started_usec  = started_usec
+        response.worker_finished_usec = self._TimeUsec()
 
       print >> sys.stderr, "<" * 80
       print >> sys.stderr, response
 
-      self.WriteMessage(output_handle, response)
+      self.WriteMessage(output_handle, response, encoded_fields)
@@ -0,0 +1,168 @@
+"""
+Makes the worker's protobufs as fast as the installed protobuf library allows.
+
+The library's C++ implementation is much faster than the pure Python one, but
+isn't used unless it's asked for.  Without it, building and serialising a
+response with thousands of results can take longer than finding them, so the
+largest responses can be encoded by hand instead.
+"""
+
+import os
+import pkgutil
+
+IMPLEMENTATION_VARIABLE = "PROTOCOL_BUFFERS_PYTHON_IMPLEMENTATION"
+
+# The C++ extension modules of different versions of the protobuf library.
+CPP_MODULES = [
+  "google.protobuf.internal._net_proto2___python",
+  "google.protobuf.pyext._message",
+]
+
+WIRETYPE_VARINT           = 0
+WIRETYPE_LENGTH_DELIMITED = 2
+
+# Field numbers from rpc.proto.
+SEARCH_RESPONSE_RESULT = 1
+SEARCH_RESULT_MODULE_NAME = 1
+SEARCH_RESULT_FILE_PATH   = 2
+SEARCH_RESULT_LINE_NUMBER = 3
+SEARCH_RESULT_SYMBOL_NAME = 4
+SEARCH_RESULT_SYMBOL_TYPE = 5
+
+COMPLETION_RESPONSE_PROPOSAL           = 1
+COMPLETION_RESPONSE_INSERTION_POSITION = 2
+PROPOSAL_NAME      = 1
+PROPOSAL_TYPE      = 2
+PROPOSAL_SCOPE     = 3
+PROPOSAL_DOCSTRING = 4
+
+# Varints below 128 are a single byte, and most of the ones we encode are.
+SMALL_VARINTS = [chr(value) for value in xrange(128)]
+
+
+def UseFastestImplementation():
+  """
+  Makes the protobuf library use its C++ implementation if it's installed,
+  unless another one was asked for in the environment.  Must be called before
+  any protobufs are imported.
+  """
+
+  if IMPLEMENTATION_VARIABLE in os.environ:
+    return
+
+  for name in CPP_MODULES:
+    try:
+      found = pkgutil.find_loader(name) is not None
+    except ImportError:
+      found = False
+
+    if found:
+      os.environ[IMPLEMENTATION_VARIABLE] = "cpp"
+      return
+
+
+def IsPurePython():
+  """
+  Returns True if the protobuf library is using its pure Python implementation.
+  """
+
+  try:
+    from google.protobuf.internal import api_implementation
+  except ImportError:
+    return True
+
+  return api_implementation.Type() == "python"
+
+
+def EncodeVarint(value):
+  """
+  Returns the value encoded as a varint.  Negative values take ten bytes, like
+  negative int32s do.
+  """
+
+  if 0 <= value < 128:
+    return SMALL_VARINTS[value]
+
+  if value < 0:
+    value += 1 << 64
+
+  ret = []
+  while value >= 128:
+    ret.append(chr(0x80 | (value & 0x7f)))
+    value >>= 7
+  ret.append(chr(value))
+  return "".join(ret)
+
+
+def EncodeTag(number, wire_type):
+  """
+  Returns the key that goes before a field's value.
+  """
+
+  return EncodeVarint((number << 3) | wire_type)
+
+
+def EncodeLengthDelimited(number, data):
+  """
+  Returns a string, bytes or message field with the given serialised value.
+  Unicode strings are encoded as UTF-8.
+  """
+
+  if isinstance(data, unicode):
+    data = data.encode("utf-8")
+
+  return EncodeTag(number, WIRETYPE_LENGTH_DELIMITED) + \
+         EncodeVarint(len(data)) + data
+
+
+def EncodeInt(number, value):
+  """
+  Returns an int32, int64 or enum field with the given value.
+  """
+
+  return EncodeTag(number, WIRETYPE_VARINT) + EncodeVarint(value)
+
+
+def EncodeSearchResponse(results):
+  """
+  Returns a serialised SearchResponse.  results is a list of (module_name,
+  file_path, line_number, symbol_name, symbol_type) tuples.
+  """
+
+  ret = []
+  for module_name, file_path, line_number, symbol_name, symbol_type in results:
+    result = "".join([
+      EncodeLengthDelimited(SEARCH_RESULT_MODULE_NAME, module_name),
+      EncodeLengthDelimited(SEARCH_RESULT_FILE_PATH, file_path),
+      EncodeInt(SEARCH_RESULT_LINE_NUMBER, line_number),
+      EncodeLengthDelimited(SEARCH_RESULT_SYMBOL_NAME, symbol_name),
+      EncodeInt(SEARCH_RESULT_SYMBOL_TYPE, symbol_type),
+    ])
+    ret.append(EncodeLengthDelimited(SEARCH_RESPONSE_RESULT, result))
+
+  return "".join(ret)
+
+
+def EncodeCompletionResponse(proposals, insertion_position):
+  """
+  Returns a serialised CompletionResponse without a calltip.  proposals is a
+  list of (name, type, scope, docstring) tuples - any but the name can be
+  None if they aren't known.
+  """
+
+  ret = []
+  for name, proposal_type, scope, docstring in proposals:
+    proposal = [EncodeLengthDelimited(PROPOSAL_NAME, name)]
+    if proposal_type is not None:
+      proposal.append(EncodeInt(PROPOSAL_TYPE, proposal_type))
+    if scope is not None:
+      proposal.append(EncodeInt(PROPOSAL_SCOPE, scope))
+    if docstring is not None:
+      proposal.append(EncodeLengthDelimited(PROPOSAL_DOCSTRING, docstring))
+
+    ret.append(EncodeLengthDelimited(COMPLETION_RESPONSE_PROPOSAL,
+                                     "".join(proposal)))
+
+  ret.append(EncodeInt(COMPLETION_RESPONSE_INSERTION_POSITION,
+                       insertion_position))
+  return "".join(ret)
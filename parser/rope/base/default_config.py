@@ -16,6 +16,13 @@ def set_prefs(prefs):
     prefs['ignored_resources'] = ['*.pyc', '*~', '.ropeproject',
                                   '.hg', '.svn', '_svn', '.git']
 
+    # If `True`, resources ignored by ``.gitignore`` files are ignored
+    # by rope as well.  Ignored folders are never walked.
+    prefs['use_gitignore'] = True
+
+    # Should rope save the list of the project's files or not.
+    prefs['save_filelist'] = True
+
     # Specifies which files should be considered python files.  It is
     # useful when you have scripts inside your project.  Only files
     # ending with ``.py`` are considered to be python files by
@@ -39,8 +46,22 @@ def set_prefs(prefs):
     prefs['save_objectdb'] = True
     prefs['compress_objectdb'] = False
 
+    # How many files' object information to keep in memory.  The
+    # least recently used ones are written to disk and reloaded when
+    # needed; use `None` for no limit.  There is no limit when
+    # `save_objectdb` is `False`.
+    prefs['max_loaded_objectdb_files'] = 256
+
+    # How many calls to remember for each function.  Other calls are
+    # forgotten to make room for new ones; use `None` for no limit.
+    prefs['max_objectdb_call_infos'] = 32
+
     # If `True`, rope analyzes each module when it is being saved.
     prefs['automatic_soa'] = True
+    # If `True` the modules are not analyzed as soon as they are
+    # saved; they are queued until `PyCore.perform_deferred_soa()` is
+    # called, for instance when the editor is idle.
+    prefs['deferred_soa'] = False
     # The depth of calls to follow in static object analysis
     prefs['soa_followed_calls'] = 0
 
@@ -1,7 +1,21 @@
+import cPickle as pickle
+import collections
+import os
+import sqlite3
+import zlib
+
 from rope.base.oi import objectdb
 
 
 class MemoryDB(objectdb.FileDict):
+    """Holds object information in memory
+
+    If persistence is enabled the information is stored in an
+    indexed database in the project's rope folder.  The `ScopeInfo`\s
+    of a file are only loaded when they are first needed and only
+    files that have changed are written back.
+
+    """
 
     def __init__(self, project, persist=None):
         self.project = project
@@ -11,38 +25,117 @@ class MemoryDB(objectdb.FileDict):
         self.project.data_files.add_write_hook(self.write)
 
     def _load_files(self):
-        self._files = {}
-        if self.persist:
-            result = self.project.data_files.read_data(
-                'objectdb', compress=self.compress, import_=True)
-            if result is not None:
-                self._files = result
+        self._files = collections.OrderedDict()
+        self._paths = set()
+        self._changed = set()
+        self._store = None
+        if self.persist and self.project.ropefolder is not None:
+            self._store = _FileStore(os.path.join(
+                self.project.ropefolder.real_path, 'objectdb.db'))
+            if self._store.exists():
+                self._paths.update(self._store.keys())
+            else:
+                self._import_pickled_files()
+
+    def _import_pickled_files(self):
+        result = self.project.data_files.read_data(
+            'objectdb', compress=self.compress, import_=True)
+        if result is not None:
+            self._files.update(result)
+            self._paths.update(result)
+            self._changed.update(result)
+
+    def _get_scopes(self, path):
+        if path in self._files:
+            scopes = self._files.pop(path)
+        elif path in self._paths:
+            scopes = self._store.read(path)
+        else:
+            raise KeyError(path)
+        self._files[path] = scopes
+        self._evict_files()
+        return scopes
+
+    def _evict_files(self):
+        # Without a store evicted information would be lost, so
+        # everything stays in memory
+        max_files = self.max_loaded_files
+        if max_files is None or self._store is None:
+            return
+        while len(self._files) > max_files:
+            path, scopes = self._files.popitem(last=False)
+            if path in self._changed:
+                self._store.save(path, scopes, self.compress)
+                self._changed.discard(path)
 
     def keys(self):
-        return self._files.keys()
+        return list(self._paths)
 
     def __contains__(self, key):
-        return key in self._files
+        return key in self._paths
 
     def __getitem__(self, key):
-        return FileInfo(self._files[key])
+        return FileInfo(self._get_scopes(key), self.max_call_infos)
 
     def create(self, path):
         self._files[path] = {}
+        self._paths.add(path)
+        self._changed.add(path)
+        self._evict_files()
 
     def rename(self, file, newfile):
-        if file not in self._files:
+        if file not in self._paths:
             return
-        self._files[newfile] = self._files[file]
+        scopes = self._get_scopes(file)
         del self[file]
+        self._files[newfile] = scopes
+        self._paths.add(newfile)
+        self._changed.add(newfile)
+        self._evict_files()
+
+    def changed(self, path):
+        self._changed.add(path)
 
     def __delitem__(self, file):
-        del self._files[file]
+        self._paths.remove(file)
+        self._files.pop(file, None)
+        self._changed.add(file)
 
     def write(self):
-        if self.persist:
-            self.project.data_files.write_data('objectdb', self._files,
-                                               self.compress)
+        if self._store is None:
+            self._changed.clear()
+            return
+        if not self._changed:
+            return
+        for path in self._changed:
+            if path in self._paths:
+                self._store.save(path, self._files[path], self.compress)
+            else:
+                self._store.remove(path)
+        self._store.commit()
+        self._changed.clear()
+
+    def get_stats(self):
+        scopes = call_infos = per_names = 0
+        for file_scopes in self._files.values():
+            scopes += len(file_scopes)
+            for scope in file_scopes.values():
+                call_infos += len(scope.call_info)
+                per_names += len(scope.per_name)
+        stored_size = 0
+        if self._store is not None and self._store.exists():
+            stored_size = os.path.getsize(self._store.filename)
+        return {'files': len(self._paths), 'loaded_files': len(self._files),
+                'scopes': scopes, 'call_infos': call_infos,
+                'per_names': per_names, 'stored_size': stored_size}
+
+    @property
+    def max_loaded_files(self):
+        return self.project.prefs.get('max_loaded_objectdb_files', 256)
+
+    @property
+    def max_call_infos(self):
+        return self.project.prefs.get('max_objectdb_call_infos', 32)
 
     @property
     def compress(self):
@@ -56,10 +149,78 @@ class MemoryDB(objectdb.FileDict):
             return self.project.prefs.get('save_objectdb', False)
 
 
+class _FileStore(object):
+    """Stores the pickled scopes of each file in an sqlite database
+
+    The connection is opened lazily because the rope folder might not
+    have been created yet when the project is opened.  Several
+    processes can have the same project open, so writers wait for each
+    other and readers see the last committed version.
+
+    """
+
+    # Seconds to wait for another process's write to finish
+    LOCK_TIMEOUT = 30
+
+    SCHEMA = """
+        CREATE TABLE IF NOT EXISTS files (
+            path TEXT PRIMARY KEY,
+            compressed INTEGER,
+            scopes BLOB
+        );
+    """
+
+    def __init__(self, filename):
+        self.filename = filename
+        self._conn = None
+
+    def exists(self):
+        return os.path.exists(self.filename)
+
+    @property
+    def conn(self):
+        if self._conn is None:
+            self._conn = sqlite3.connect(self.filename,
+                                         timeout=self.LOCK_TIMEOUT)
+            self._conn.text_factory = str
+            self._conn.execute('PRAGMA journal_mode=WAL')
+            self._conn.executescript(self.SCHEMA)
+        return self._conn
+
+    def keys(self):
+        return [row[0] for row in self.conn.execute('SELECT path FROM files')]
+
+    def read(self, path):
+        row = self.conn.execute(
+            'SELECT compressed, scopes FROM files WHERE path = ?',
+            (path,)).fetchone()
+        if row is None:
+            return {}
+        data = str(row[1])
+        if row[0]:
+            data = zlib.decompress(data)
+        return pickle.loads(data)
+
+    def save(self, path, scopes, compress=False):
+        data = pickle.dumps(scopes, 2)
+        if compress:
+            data = zlib.compress(data)
+        self.conn.execute(
+            'INSERT OR REPLACE INTO files (path, compressed, scopes) '
+            'VALUES (?, ?, ?)', (path, int(compress), sqlite3.Binary(data)))
+
+    def remove(self, path):
+        self.conn.execute('DELETE FROM files WHERE path = ?', (path,))
+
+    def commit(self):
+        self.conn.commit()
+
+
 class FileInfo(objectdb.FileInfo):
 
-    def __init__(self, scopes):
+    def __init__(self, scopes, max_call_infos=None):
         self.scopes = scopes
+        self.max_call_infos = max_call_infos
 
     def create_scope(self, key):
         self.scopes[key] = ScopeInfo()
@@ -71,7 +232,9 @@ class FileInfo(objectdb.FileInfo):
         return key in self.scopes
 
     def __getitem__(self, key):
-        return self.scopes[key]
+        scope = self.scopes[key]
+        scope.max_call_infos = self.max_call_infos
+        return scope
 
     def __delitem__(self, key):
         del self.scopes[key]
@@ -79,6 +242,8 @@ class FileInfo(objectdb.FileInfo):
 
 class ScopeInfo(objectdb.ScopeInfo):
 
+    max_call_infos = None
+
     def __init__(self):
         self.call_info = {}
         self.per_name = {}
@@ -87,7 +252,7 @@ class ScopeInfo(objectdb.ScopeInfo):
         return self.per_name.get(name, None)
 
     def save_per_name(self, name, value):
-        self.per_name[name] = value
+        self.per_name[_compact(name)] = _compact(value)
 
     def get_returned(self, parameters):
         return self.call_info.get(parameters, None)
@@ -97,10 +262,30 @@ class ScopeInfo(objectdb.ScopeInfo):
             yield objectdb.CallInfo(args, returned)
 
     def add_call(self, parameters, returned):
-        self.call_info[parameters] = returned
+        if parameters not in self.call_info and \
+           self.max_call_infos is not None and \
+           len(self.call_info) >= self.max_call_infos:
+            # Make room by forgetting an arbitrary call
+            self.call_info.popitem()
+        self.call_info[_compact(parameters)] = _compact(returned)
 
     def __getstate__(self):
         return (self.call_info, self.per_name)
 
     def __setstate__(self, data):
         self.call_info, self.per_name = data
+
+
+def _compact(textual):
+    """Share the strings of a textual form with equal ones
+
+    Textuals are tuples of short strings (kinds, paths and names) that
+    repeat over and over in the database.  Interning them keeps only
+    one copy of each in memory.
+
+    """
+    if isinstance(textual, tuple):
+        return tuple([_compact(item) for item in textual])
+    if type(textual) is str:
+        return intern(textual)
+    return textual
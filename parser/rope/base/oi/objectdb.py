@@ -21,6 +21,7 @@ class ObjectDB(object):
         for key in list(self.files[file]):
             if not self.validation.is_scope_valid(file, key):
                 del self.files[file][key]
+                self.files.changed(file)
 
     def file_moved(self, file, newfile):
         if file not in self.files:
@@ -66,6 +67,9 @@ class ObjectDB(object):
     def write(self):
         self.db.write()
 
+    def get_stats(self):
+        return self.db.get_stats()
+
     def _get_scope_info(self, path, key, readonly=True):
         if path not in self.files:
             if readonly:
@@ -76,6 +80,8 @@ class ObjectDB(object):
             if readonly:
                 return _NullScopeInfo()
             self.files[path].create_scope(key)
+        if not readonly:
+            self.files.changed(path)
         result = self.files[path][key]
         if isinstance(result, dict):
             print self.files, self.files[path], self.files[path][key]
@@ -134,6 +140,12 @@ class FileDict(UserDict.DictMixin):
     def rename(self, key, new_key):
         pass
 
+    def changed(self, key):
+        pass
+
+    def get_stats(self):
+        return {}
+
 
 class ScopeInfo(object):
 
@@ -183,6 +183,10 @@ class ObjectInfoManager(object):
     def sync(self):
         self.objectdb.sync()
 
+    def get_stats(self):
+        """Return a `dict` describing the size of the object DB"""
+        return self.objectdb.get_stats()
+
     def __str__(self):
         return str(self.objectdb)
 
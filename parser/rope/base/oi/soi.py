@@ -17,13 +17,18 @@ _ignore_inferred = utils.ignore_exception(
 @_ignore_inferred
 def infer_returned_object(pyfunction, args):
     """Infer the `PyObject` this `PyFunction` returns after calling"""
-    object_info = pyfunction.pycore.object_info
+    pycore = pyfunction.pycore
+    object_info = pycore.object_info
     result = object_info.get_exact_returned(pyfunction, args)
     if result is not None:
         return result
+    if pycore.inference_stopped():
+        return object_info.get_returned(pyfunction, args)
     result = _infer_returned(pyfunction, args)
     if result is not None:
-        if args and pyfunction.get_module().get_resource() is not None:
+        # Results found after running out of time might be incomplete
+        if args and pyfunction.get_module().get_resource() is not None \
+           and not pycore.inference_stopped():
             params = args.get_arguments(
                 pyfunction.get_param_names(special_args=False))
             object_info.function_called(pyfunction, params, result)
@@ -57,9 +62,10 @@ def _handle_first_parameter(pyobject, parameters):
 def infer_assigned_object(pyname):
     if not pyname.assignments:
         return
+    pycore = pyname.module.pycore
     for assignment in reversed(pyname.assignments):
         result = _infer_assignment(assignment, pyname.module)
-        if result is not None:
+        if result is not None or pycore.inference_stopped():
             return result
 
 def get_passed_objects(pyfunction, parameter_index):
@@ -83,8 +89,11 @@ def _infer_returned(pyobject, args):
     scope = pyobject.get_scope()
     if not scope._get_returned_asts():
         return
+    pycore = pyobject.pycore
     maxtries = 3
     for returned_node in reversed(scope._get_returned_asts()[-maxtries:]):
+        if pycore.inference_stopped():
+            return
         try:
             resulting_pyname = evaluate.eval_node(scope, returned_node)
             if resulting_pyname is None:
@@ -1,13 +1,15 @@
 import cPickle as pickle
 import os
 import shutil
+import stat
 import sys
 import warnings
 
 import rope.base.fscommands
 from rope.base import exceptions, taskhandle, prefs, history, pycore, utils
 from rope.base.resourceobserver import *
-from rope.base.resources import File, Folder, _ResourceMatcher
+from rope.base.resources import File, Folder, _ResourceMatcher, \
+                                _GitIgnoreMatcher
 
 
 class _Project(object):
@@ -139,6 +141,7 @@ class Project(_Project):
             fscommands = rope.base.fscommands.create_fscommands(self._address)
         super(Project, self).__init__(fscommands)
         self.ignored = _ResourceMatcher()
+        self.gitignore = _GitIgnoreMatcher(self)
         self.file_list = _FileListCacher(self)
         self.prefs.add_callback('ignored_resources', self.ignored.set_patterns)
         if ropefolder is not None:
@@ -195,7 +198,17 @@ class Project(_Project):
         self.pycore
 
     def is_ignored(self, resource):
-        return self.ignored.does_match(resource)
+        return self.ignored.does_match(resource) or \
+               self._is_gitignored(resource.path, resource.is_folder())
+
+    def _is_ignored_path(self, path, is_folder):
+        """Like `is_ignored()` for a path that is not a symlink"""
+        return self.ignored.does_match_path(path) or \
+               self._is_gitignored(path, is_folder)
+
+    def _is_gitignored(self, path, is_folder):
+        return self.prefs.get('use_gitignore', True) and \
+               self.gitignore.does_match(path, is_folder)
 
     def sync(self):
         """Closes project open resources"""
@@ -254,87 +267,129 @@ def get_no_project():
 
 
 class _FileListCacher(object):
+    """Keeps the list of files in the project
+
+    The files and folders inside each folder are remembered together
+    with the modification times of the folder and its ``.gitignore``.
+    A folder is only listed again when its modification time changes;
+    when its ``.gitignore`` changes, the folders inside it are listed
+    again too.  The list is saved in the rope folder so that opening
+    a project only needs to stat its folders.
+
+    """
 
     def __init__(self, project):
         self.project = project
-        self.needs_gc = True
         self.files = set()
-        self.folders = set()
+        self.manifest = None
+        self.needs_write = False
+        self.project.data_files.add_write_hook(self.write)
 
     def get_files(self):
-        if self.needs_gc:
-            # forcing the creation of the observer
-            self.observer
-            for file in list(self.files):
-                if not file.exists():
-                    self.files.remove(file)
-            for folder in list(self.folders):
-                if not folder.exists():
-                    self.folders.remove(folder)
-                    self.observer.remove_resource(folder)
-            self.needs_gc = False
+        if self.manifest is None:
+            self.manifest = self._read_manifest()
+            self._update()
+            self._update_files()
+        elif self._update():
+            self._update_files()
         return self.files
 
-    def _updated_resources(self, folder):
-        if not folder.exists():
-            return set(), set()
-        files = set()
-        folders = set([folder])
-        files.update(folder.get_files())
-        for child in folder.get_folders():
-            if child not in self.folders:
-                newfiles, newfolders = self._updated_resources(child)
-                files.update(newfiles)
-                folders.update(newfolders)
+    def _update(self):
+        """Relist the folders that have changed
+
+        Returns `True` if the manifest has changed.
+        """
+        old = self.manifest
+        new = {}
+        updated = False
+        # A ``.gitignore`` applies to everything below its folder, so
+        # a changed one forces its subfolders to be listed again
+        pending = [('', False)]
+        while pending:
+            path, force = pending.pop()
+            try:
+                mtime = os.stat(self.project._get_resource_path(path)).st_mtime
+            except OSError:
+                continue
+            gitignore_mtime = self._gitignore_mtime(path)
+            entry = old.get(path)
+            if entry is not None and entry[3] != gitignore_mtime:
+                force = True
+            if force or entry is None or entry[0] != mtime:
+                entry = (mtime,) + self._list_folder(path) + \
+                        (gitignore_mtime,)
+                updated = True
+            new[path] = entry
+            pending.extend((_join_path(path, name), force)
+                           for name in entry[2])
+        if updated or len(new) != len(old):
+            self.manifest = new
+            self.needs_write = True
+            return True
+        return False
+
+    def _update_files(self):
+        self.files = set()
+        for path, (mtime, files, folders, gitignore_mtime) in \
+                self.manifest.iteritems():
+            self.files.update(File(self.project, _join_path(path, name))
+                              for name in files)
+
+    def _list_folder(self, path):
+        # The ``.gitignore`` of a folder may have changed with it
+        self.project.gitignore.forget(path)
+        files = []
+        folders = []
+        for name in os.listdir(self.project._get_resource_path(path)):
+            child_path = _join_path(path, name)
+            try:
+                mode = os.lstat(
+                    self.project._get_resource_path(child_path)).st_mode
+            except OSError:
+                continue
+            # Symlinks are always ignored; ignored folders are pruned
+            # here so nothing inside them is ever listed
+            if stat.S_ISDIR(mode):
+                if not self.project._is_ignored_path(child_path, True):
+                    folders.append(name)
+            elif stat.S_ISREG(mode):
+                if not self.project._is_ignored_path(child_path, False):
+                    files.append(name)
         return files, folders
 
-    def _update_folder(self, folder):
-        files, folders = self._updated_resources(folder)
-        self.files.update(files)
-        for child in folders - self.folders:
-            self.folders.add(child)
-            self.observer.add_resource(child)
-        self.needs_gc = True
+    def _read_manifest(self):
+        data = self.project.data_files.read_data('filelist')
+        if data is not None:
+            key, manifest = data
+            if key == self._manifest_key():
+                return manifest
+        return {}
 
-    @property
-    @utils.saveit
-    def observer(self):
-        rawobserver = ResourceObserver(
-            self._changed, self._moved, self._created,
-            self._removed, self._validate)
-        observer = FilteredResourceObserver(rawobserver)
-        self.project.add_observer(observer)
-        self._update_folder(self.project.root)
-        return observer
-
-    def _changed(self, resource):
-        if resource.is_folder():
-            self._update_folder(resource)
-
-    def _moved(self, resource, new_resource):
-        if resource.is_folder():
-            self._update_folder(resource)
-            self._update_folder(new_resource)
-        else:
-            self._removed(resource)
-            self._created(new_resource)
+    def write(self):
+        if self.needs_write and self.project.prefs.get('save_filelist', True):
+            self.project.data_files.write_data(
+                'filelist', (self._manifest_key(), self.manifest))
+            self.needs_write = False
 
-    def _created(self, resource):
-        if resource.is_folder():
-            self._update_folder(resource)
-        else:
-            if not self.project.is_ignored(resource):
-                self.files.add(resource)
+    def _gitignore_mtime(self, path):
+        if not self.project.prefs.get('use_gitignore', True):
+            return None
+        try:
+            return os.stat(self.project._get_resource_path(
+                _join_path(path, '.gitignore'))).st_mtime
+        except OSError:
+            return None
 
-    def _removed(self, resource):
-        if resource.is_folder():
-            self._update_folder(resource)
-        else:
-            if resource in self.files:
-                self.files.remove(resource)
+    def _manifest_key(self):
+        """The settings the saved manifest depends on"""
+        return (list(self.project.ignored.patterns),
+                self.project.prefs.get('use_gitignore', True))
 
-    def _validate(self, resource):
-        pass
+
+def _join_path(path, name):
+    if path:
+        return path + '/' + name
+    return name
 
 
 class _DataFiles(object):
@@ -1,4 +1,5 @@
 import bisect
+import collections
 import difflib
 import sys
 import warnings
@@ -23,10 +24,29 @@ class PyCore(object):
         self.module_cache = _ModuleCache(self)
         self.extension_cache = _ExtensionCache(self)
         self.object_info = rope.base.oi.objectinfo.ObjectInfoManager(project)
+        # When this `TaskHandle` is stopped static object inference
+        # gives up and returns what it already knows
+        self.inference_handle = None
+        # Modules whose concluded data changed while `inference_handle`
+        # was set
+        self.inference_touched_modules = set()
+        # While this is a dict, modules made from the same code by
+        # `get_string_module()` are kept in it and reused
+        self.string_module_cache = None
         self._init_python_files()
         self._init_automatic_soa()
         self._init_source_folders()
 
+    def inference_stopped(self):
+        """Whether the time for inferring objects has run out"""
+        return self.inference_handle is not None and \
+               self.inference_handle.is_stopped()
+
+    def concluded_data_changed(self, pymodule):
+        """Called when something about `pymodule` is concluded"""
+        if self.inference_handle is not None:
+            self.inference_touched_modules.add(pymodule)
+
     def _init_python_files(self):
         self.python_matcher = None
         patterns = self.project.prefs.get('python_files', None)
@@ -48,6 +68,7 @@ class PyCore(object):
             self._custom_source_folders.append(folder)
 
     def _init_automatic_soa(self):
+        self._deferred_soa = collections.OrderedDict()
         if not self.automatic_soa:
             return
         callback = self._file_changed_for_soa
@@ -64,7 +85,44 @@ class PyCore(object):
         old_contents = self.project.history.\
                        contents_before_current_change(resource)
         if old_contents is not None:
-            perform_soa_on_changed_scopes(self.project, resource, old_contents)
+            if self.project.prefs.get('deferred_soa', False):
+                # Keep the oldest contents so that every change since
+                # the last analysis is considered
+                self._deferred_soa.setdefault(resource, old_contents)
+            else:
+                perform_soa_on_changed_scopes(self.project, resource,
+                                              old_contents)
+
+    def has_deferred_soa(self):
+        """Tell whether some changed modules are waiting for SOA"""
+        return bool(self._deferred_soa)
+
+    def perform_deferred_soa(self, task_handle=taskhandle.NullTaskHandle()):
+        """Analyze the changed modules queued by automatic SOA
+
+        When ``deferred_soa`` project config is `True`, automatic SOA
+        does not analyze modules as soon as they change; they are
+        queued until this method is called.  If `task_handle` is
+        stopped the module being analyzed stays in the queue and
+        `exceptions.InterruptedTaskError` is raised.  The collected
+        information is written to the object DB in either case.
+
+        """
+        job_set = task_handle.create_jobset('Analyzing changed modules',
+                                            len(self._deferred_soa))
+        try:
+            while self._deferred_soa:
+                resource, old_contents = self._deferred_soa.popitem(last=False)
+                try:
+                    job_set.started_job(resource.path)
+                    perform_soa_on_changed_scopes(self.project, resource,
+                                                  old_contents, job_set)
+                except exceptions.InterruptedTaskError:
+                    self._deferred_soa[resource] = old_contents
+                    raise
+                job_set.finished_job()
+        finally:
+            self.object_info.objectdb.write()
 
     def is_python_file(self, resource):
         if resource.is_folder():
@@ -109,7 +167,13 @@ class PyCore(object):
         ``ignore_syntax_errors`` project config.
 
         """
-        return PyModule(self, code, resource, force_errors=force_errors)
+        if self.string_module_cache is None:
+            return PyModule(self, code, resource, force_errors=force_errors)
+        key = (code, resource, force_errors)
+        if key not in self.string_module_cache:
+            self.string_module_cache[key] = PyModule(
+                self, code, resource, force_errors=force_errors)
+        return self.string_module_cache[key]
 
     def get_string_scope(self, code, resource=None):
         """Returns a `Scope` object for the given code"""
@@ -345,7 +409,8 @@ class _ExtensionCache(object):
         return self.extensions.get(name)
 
 
-def perform_soa_on_changed_scopes(project, resource, old_contents):
+def perform_soa_on_changed_scopes(project, resource, old_contents,
+                                  job_set=taskhandle.NullJobSet()):
     pycore = project.pycore
     if resource.exists() and pycore.is_python_file(resource):
         try:
@@ -356,6 +421,7 @@ def perform_soa_on_changed_scopes(project, resource, old_contents):
                 scope = pydefined.get_scope()
                 return detector.is_changed(scope.get_start(), scope.get_end())
             def should_analyze(pydefined):
+                job_set.check_status()
                 scope = pydefined.get_scope()
                 start = scope.get_start()
                 end = scope.get_end()
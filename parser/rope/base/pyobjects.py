@@ -260,11 +260,14 @@ class PyClass(PyDefinedObject, AbstractClass):
 
 class _ConcludedData(object):
 
-    def __init__(self):
+    def __init__(self, module=None):
         self.data_ = None
+        self.module = module
 
     def set(self, data):
         self.data_ = data
+        if self.module is not None:
+            self.module.pycore.concluded_data_changed(self.module)
 
     def get(self):
         return self.data_
@@ -272,7 +275,7 @@ class _ConcludedData(object):
     data = property(get, set)
 
     def _invalidate(self):
-        self.data = None
+        self.data_ = None
 
     def __str__(self):
         return '<' + str(self.data) + '>'
@@ -287,7 +290,7 @@ class _PyModule(PyDefinedObject, AbstractModule):
         PyDefinedObject.__init__(self, pycore, ast_node, None)
 
     def _get_concluded_data(self):
-        new_data = _ConcludedData()
+        new_data = _ConcludedData(self)
         self.concluded_data.append(new_data)
         return new_data
 
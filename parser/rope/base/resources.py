@@ -121,7 +121,7 @@ class Folder(Resource):
             except exceptions.ResourceNotFoundError:
                 continue
             if not self.project.is_ignored(child):
-                result.append(self.get_child(name))
+                result.append(child)
         return result
 
     def create_file(self, file_name):
@@ -173,7 +173,7 @@ class _ResourceMatcher(object):
 
     def __init__(self):
         self.patterns = []
-        self._compiled_patterns = []
+        self._regex = None
 
     def set_patterns(self, patterns):
         """Specify which resources to match
@@ -182,30 +182,133 @@ class _ResourceMatcher(object):
         ``?`` signs for matching resource names.
 
         """
-        self._compiled_patterns = None
+        self._regex = None
         self.patterns = patterns
 
-    def _add_pattern(self, pattern):
-        re_pattern = pattern.replace('.', '\\.').\
-                     replace('*', '[^/]*').replace('?', '[^/]').\
-                     replace('//', '/(.*/)?')
-        re_pattern = '^(.*/)?' + re_pattern + '(/.*)?$'
-        self.compiled_patterns.append(re.compile(re_pattern))
+    def _pattern_to_regex(self, pattern):
+        return pattern.replace('.', '\\.').\
+               replace('*', '[^/]*').replace('?', '[^/]').\
+               replace('//', '/(?:.*/)?')
 
     def does_match(self, resource):
-        for pattern in self.compiled_patterns:
-            if pattern.match(resource.path):
-                return True
+        if self.does_match_path(resource.path):
+            return True
         path = os.path.join(resource.project.address,
                             *resource.path.split('/'))
         if os.path.islink(path):
             return True
         return False
 
+    def does_match_path(self, path):
+        """Like `does_match()` but does not check for symlinks"""
+        return self.regex is not None and self.regex.match(path) is not None
+
     @property
-    def compiled_patterns(self):
-        if self._compiled_patterns is None:
-            self._compiled_patterns = []
-            for pattern in self.patterns:
-                self._add_pattern(pattern)
-        return self._compiled_patterns
+    def regex(self):
+        """All the patterns compiled into a single regular expression"""
+        if self._regex is None and self.patterns:
+            alternatives = '|'.join('(?:%s)' % self._pattern_to_regex(pattern)
+                                    for pattern in self.patterns)
+            self._regex = re.compile('^(?:.*/)?(?:%s)(?:/.*)?$' % alternatives)
+        return self._regex
+
+
+class _GitIgnoreMatcher(object):
+    """Matches resources ignored by ``.gitignore`` files
+
+    The ``.gitignore`` file of a folder is read the first time a
+    resource inside that folder is checked.  Call `forget()` when the
+    contents of a folder change to read its ``.gitignore`` again.
+
+    """
+
+    def __init__(self, project):
+        self.project = project
+        self.rules = {}
+
+    def does_match(self, path, is_folder):
+        parts = path.split('/')
+        # Rules in deeper folders and later lines take precedence
+        for index in range(len(parts) - 1, -1, -1):
+            relative = '/'.join(parts[index:])
+            if is_folder:
+                relative += '/'
+            for regex, negated in reversed(self._get_rules(parts[:index])):
+                if regex.match(relative):
+                    return not negated
+        return False
+
+    def forget(self, folder_path):
+        self.rules.pop(folder_path, None)
+
+    def _get_rules(self, folder_parts):
+        folder_path = '/'.join(folder_parts)
+        if folder_path not in self.rules:
+            self.rules[folder_path] = self._read_rules(folder_parts)
+        return self.rules[folder_path]
+
+    def _read_rules(self, folder_parts):
+        path = os.path.join(self.project.address,
+                            *(folder_parts + ['.gitignore']))
+        try:
+            lines = open(path).read().splitlines()
+        except IOError:
+            return []
+        result = []
+        for line in lines:
+            line = line.rstrip()
+            if line and not line.startswith('#'):
+                result.append(self._compile(line))
+        return result
+
+    def _compile(self, pattern):
+        negated = pattern.startswith('!')
+        if negated:
+            pattern = pattern[1:]
+        elif pattern.startswith('\\'):
+            pattern = pattern[1:]
+        folder_only = pattern.endswith('/')
+        pattern = pattern.rstrip('/')
+        # Patterns containing a slash are relative to the folder of
+        # the ``.gitignore``; others match at any depth
+        if '/' in pattern:
+            re_pattern = '^' + self._translate(pattern.lstrip('/'))
+        else:
+            re_pattern = '^(?:.*/)?' + self._translate(pattern)
+        # Folder paths are checked with a trailing slash, so requiring
+        # one matches only folders and anything inside them
+        if folder_only:
+            re_pattern += '/'
+        else:
+            re_pattern += '(?:/.*)?$'
+        return re.compile(re_pattern), negated
+
+    def _translate(self, pattern):
+        result = []
+        index = 0
+        while index < len(pattern):
+            if pattern.startswith('**/', index):
+                result.append('(?:.*/)?')
+                index += 3
+                continue
+            if pattern.startswith('/**', index) and \
+               index + 3 == len(pattern):
+                result.append('/.*')
+                index += 3
+                continue
+            char = pattern[index]
+            if char == '*':
+                result.append('[^/]*')
+            elif char == '?':
+                result.append('[^/]')
+            elif char == '[' and ']' in pattern[index + 1:]:
+                end = pattern.index(']', index + 1)
+                body = pattern[index + 1:end]
+                if body.startswith('!'):
+                    body = '^' + body[1:]
+                result.append('[%s]' % body.replace('\\', '\\\\'))
+                index = end
+            else:
+                result.append(re.escape(char))
+            index += 1
+        return ''.join(result)
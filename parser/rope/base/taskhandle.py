@@ -1,3 +1,4 @@
+import time
 import warnings
 
 from rope.base import exceptions
@@ -55,6 +56,20 @@ class TaskHandle(object):
             observer()
 
 
+class DeadlineTaskHandle(TaskHandle):
+    """A `TaskHandle` that stops itself after `budget` seconds"""
+
+    def __init__(self, name='Task', budget=None):
+        super(DeadlineTaskHandle, self).__init__(name)
+        self.deadline = None
+        if budget is not None:
+            self.deadline = time.time() + budget
+
+    def is_stopped(self):
+        return self.stopped or (self.deadline is not None and
+                                time.time() > self.deadline)
+
+
 class JobSet(object):
 
     def __init__(self, handle, name, count):
@@ -22,6 +22,9 @@ class SymbolIndex(object):
   """
 
   DATABASE_FILENAME = "symbol_index.db"
+
+  # Seconds to wait for another worker's write to the database to finish.
+  LOCK_TIMEOUT = 30
   SCHEMA = [
     """
     CREATE TABLE files (
@@ -47,7 +50,13 @@ class SymbolIndex(object):
     # Open the database
     db_filename = os.path.join(project.ropefolder.real_path,
                                self.DATABASE_FILENAME)
-    self.conn = sqlite3.connect(db_filename)
+    self.conn = sqlite3.connect(db_filename, timeout=self.LOCK_TIMEOUT)
+
+    # Only the index worker writes to the database, but every worker searches
+    # it.  In WAL mode searches read the last committed version of the index
+    # instead of waiting for a rebuild to finish.  The mode is stored in the
+    # database file so it applies to every worker's connection.
+    self.conn.execute("PRAGMA journal_mode=WAL")
 
     with self.conn:
       # Get the current schema version
@@ -62,18 +71,26 @@ class SymbolIndex(object):
         # Apply this schema update
         self.conn.executescript(self.SCHEMA[version])
   
-  def Rebuild(self):
+  def Rebuild(self, progress=None):
     """
     Completely rebuilds the index by removing everything from the database and
-    parsing all the python files.
+    parsing all the python files.  progress is called with the number of files
+    parsed so far and the total after each file.  Returns the number of files.
     """
 
+    resources = self.project.pycore.get_python_files()
+
     with self.conn:
       self.conn.execute("DELETE FROM files")
       self.conn.execute("DELETE FROM symbols")
       self.conn.execute("DELETE FROM symbol_index")
 
-      map(self._AddFile, self.project.pycore.get_python_files())
+      for index, resource in enumerate(resources):
+        self._AddFile(resource)
+        if progress is not None:
+          progress(index + 1, len(resources))
+
+    return len(resources)
   
   def UpdateFile(self, file_path):
     """
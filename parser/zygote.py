@@ -0,0 +1,133 @@
+"""
+Forks workers from a process that has already imported and initialised
+everything they need, so new workers are ready to handle requests straight
+away and share the zygote's memory until they change it.
+"""
+
+import logging
+import os
+import signal
+import sys
+
+from rope.base import builtins, stdmods
+
+
+class Zygote(object):
+  """
+  Reads commands from a file handle, one per line:
+
+    fork <socket>  Forks a worker that connects to the local socket.
+    kill <socket>  Kills the worker that was forked for the socket.
+
+  Returns from ServeForever when the handle is closed, after killing the
+  workers that are still running.
+
+  Exited workers are only reaped just before a command is handled, so the PID
+  of a worker we're about to kill can't have been reused by another process.
+  """
+
+  def __init__(self, handler_class):
+    self.handler_class = handler_class
+
+    # Maps the socket of each worker that hasn't been reaped yet to its PID.
+    self.children = {}
+
+  @staticmethod
+  def Warm():
+    """
+    Does the expensive initialisation that rope would otherwise do lazily in
+    each worker.
+    """
+
+    builtins.builtins.get_attributes()
+    stdmods.standard_modules()
+
+  def ServeForever(self, input_handle):
+    """
+    Handles commands until the input handle is closed.
+    """
+
+    # Exited workers stay zombies until we reap them.
+    signal.signal(signal.SIGCHLD, signal.SIG_DFL)
+
+    try:
+      for line in iter(input_handle.readline, ""):
+        self.ReapChildren()
+
+        try:
+          command, socket_filename = line.split(None, 1)
+        except ValueError:
+          logging.error("Invalid zygote command %r", line)
+          continue
+
+        socket_filename = socket_filename.strip()
+
+        if command == "fork":
+          self.Fork(socket_filename)
+        elif command == "kill":
+          self.Kill(socket_filename)
+        else:
+          logging.error("Unknown zygote command %r", command)
+    finally:
+      self.ReapChildren()
+      for socket_filename in self.children.keys():
+        self.Kill(socket_filename)
+
+  def ReapChildren(self):
+    """
+    Forgets the workers that have exited.
+    """
+
+    while self.children:
+      try:
+        pid, _status = os.waitpid(-1, os.WNOHANG)
+      except OSError:
+        # No children left.
+        self.children.clear()
+        return
+
+      if not pid:
+        return
+
+      for socket_filename, child_pid in self.children.items():
+        if child_pid == pid:
+          del self.children[socket_filename]
+          break
+
+  def Fork(self, socket_filename):
+    """
+    Forks a worker that connects to the socket and handles requests.
+    """
+
+    pid = os.fork()
+    if pid:
+      self.children[socket_filename] = pid
+      return
+
+    exit_code = 0
+    try:
+      signal.signal(signal.SIGCHLD, signal.SIG_DFL)
+      sys.stdin.close()
+
+      self.handler_class().ServeForever(socket_filename)
+    except Exception:
+      logging.exception("Error in forked worker")
+      exit_code = 1
+    finally:
+      # Never return to the zygote's loop.
+      os._exit(exit_code) # pylint: disable=W0212
+
+  def Kill(self, socket_filename):
+    """
+    Kills the worker that was forked for the socket, if it's still running,
+    and reaps it.
+    """
+
+    pid = self.children.pop(socket_filename, None)
+    if pid is None:
+      return
+
+    # It hasn't been reaped, so the PID is still the worker's even if it has
+    # exited.
+    os.kill(pid, signal.SIGKILL)
+    os.waitpid(pid, 0)
@@ -28,6 +28,11 @@ const char* kEditorId = "pyqtc.PythonEditor";
 
 const char* kMenuContext = "pyqtc.ContextMenu";
 const char* kJumpToDefinitionId = "pyqtc.JumpToDefinition";
+const char* kShowMemoryStatsId = "pyqtc.ShowMemoryStats";
+const char* kShowLatencyStatsId = "pyqtc.ShowLatencyStats";
+const char* kSaveLatencyStatsId = "pyqtc.SaveLatencyStats";
+
+const char* kIndexTaskId = "pyqtc.Index";
 
 }
 }
@@ -29,6 +29,11 @@ extern const char* kEditorId;
 
 extern const char* kMenuContext;
 extern const char* kJumpToDefinitionId;
+extern const char* kShowMemoryStatsId;
+extern const char* kShowLatencyStatsId;
+extern const char* kSaveLatencyStatsId;
+
+extern const char* kIndexTaskId;
 
 }
 }
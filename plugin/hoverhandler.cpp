@@ -12,32 +12,79 @@ using namespace pyqtc;
 HoverHandler::HoverHandler(WorkerPool<WorkerClient>* worker_pool)
   : worker_pool_(worker_pool),
     current_reply_(NULL),
-    current_editor_(NULL)
+    current_editor_(NULL),
+    current_symbol_start_(-1),
+    definition_symbol_start_(-1)
 {
 }
 
+int HoverHandler::SymbolStart(const QString& source_text, int cursor_position) {
+  int start = qBound(0, cursor_position, source_text.length());
+  while (start > 0 && (source_text[start - 1].isLetterOrNumber() ||
+                       source_text[start - 1] == '_')) {
+    --start;
+  }
+  return start;
+}
+
+bool HoverHandler::CachedDefinitionLocation(
+    const QString& file_path, const QString& source_text, int cursor_position,
+    pb::DefinitionLocationResponse* response) const {
+  if (definition_symbol_start_ == -1 ||
+      definition_symbol_start_ != SymbolStart(source_text, cursor_position) ||
+      definition_file_path_ != file_path ||
+      definition_source_text_ != source_text) {
+    return false;
+  }
+
+  *response = definition_;
+  return true;
+}
+
 bool HoverHandler::acceptEditor(Core::IEditor* editor) {
   return true;
 }
 
 void HoverHandler::identifyMatch(TextEditor::ITextEditor* editor, int pos) {
-  current_reply_ = worker_pool_->NextHandler()->Tooltip(
-        editor->file()->fileName(),
-        editor->contents(),
-        pos);
+  // Look up the symbol's definition as well, from the same analysis of the
+  // source, in case the user follows it next.
+  current_file_path_ = editor->file()->fileName();
+  current_source_text_ = editor->contents();
+  current_symbol_start_ = SymbolStart(current_source_text_, pos);
+
+  WorkerBatch batch(current_file_path_, current_source_text_, pos);
+  const int tooltip_index = batch.Tooltip();
+  const int definition_index = batch.DefinitionLocation();
+
+  current_reply_ = worker_pool_->NextHandler()->SendBatch(&batch);
 
   NewClosure(current_reply_, SIGNAL(Finished(bool)),
-             this, SLOT(TooltipResponse(WorkerClient::ReplyType*)),
-             current_reply_);
+             this, SLOT(TooltipResponse(WorkerClient::ReplyType*,int,int)),
+             current_reply_, tooltip_index, definition_index);
 }
 
-void HoverHandler::TooltipResponse(WorkerClient::ReplyType* reply) {
+void HoverHandler::TooltipResponse(WorkerClient::ReplyType* reply,
+                                   int tooltip_index, int definition_index) {
   reply->deleteLater();
 
   if (!reply->is_successful() || reply != current_reply_)
     return;
 
-  const QString& text = reply->message().tooltip_response().rich_text();
+  const pb::BatchResponse& batch = reply->message().batch_response();
+  if (batch.response_size() <= qMax(tooltip_index, definition_index))
+    return;
+
+  const pb::Message& definition = batch.response(definition_index);
+  if (!definition.has_error_response()) {
+    definition_file_path_ = current_file_path_;
+    definition_source_text_ = current_source_text_;
+    definition_symbol_start_ = current_symbol_start_;
+    definition_ = definition.definition_location_response();
+  }
+
+  const QString& text =
+      batch.response(tooltip_index).tooltip_response().rich_text();
+
   if (current_editor_) {
     if (text.isEmpty())
       TextEditor::ToolTip::instance()->hide();
@@ -16,20 +16,43 @@ class HoverHandler : public TextEditor::BaseHoverHandler {
 public:
   HoverHandler(WorkerPool<WorkerClient>* worker_pool);
 
+  // The definition of the last symbol hovered over is looked up along with
+  // its tooltip.  If it's the same symbol in the same source, copies the
+  // definition's location to response and returns true.
+  bool CachedDefinitionLocation(const QString& file_path,
+                                const QString& source_text,
+                                int cursor_position,
+                                pb::DefinitionLocationResponse* response) const;
+
 private slots:
-  void TooltipResponse(WorkerClient::ReplyType* reply);
+  void TooltipResponse(WorkerClient::ReplyType* reply,
+                       int tooltip_index, int definition_index);
 
 private:
   bool acceptEditor(Core::IEditor* editor);
   void identifyMatch(TextEditor::ITextEditor* editor, int pos);
   void operateTooltip(TextEditor::ITextEditor* editor, const QPoint& point);
 
+  // Returns the position of the start of the identifier at cursor_position.
+  static int SymbolStart(const QString& source_text, int cursor_position);
+
 private:
   WorkerPool<WorkerClient>* worker_pool_;
 
   WorkerClient::ReplyType* current_reply_;
   TextEditor::ITextEditor* current_editor_;
   QPoint current_point_;
+
+  // Where current_reply_ was sent for.
+  QString current_file_path_;
+  QString current_source_text_;
+  int current_symbol_start_;
+
+  // The definition found for the last hover that finished.
+  QString definition_file_path_;
+  QString definition_source_text_;
+  int definition_symbol_start_;
+  pb::DefinitionLocationResponse definition_;
 };
 
 } // namespace
@@ -0,0 +1,198 @@
+#include "latencystats.h"
+#include "messagehandler.h"
+
+#include <QMutexLocker>
+#include <QStringList>
+
+#include <algorithm>
+
+using namespace pyqtc;
+
+const int LatencyStats::kMaxSamples = 1000;
+
+namespace {
+
+const int kPercentiles[] = {50, 95, 99};
+const int kPercentileCount = sizeof(kPercentiles) / sizeof(kPercentiles[0]);
+
+QString FormatMsec(qint64 usec) {
+  return QString::number(double(usec) / 1000.0, 'f', 1);
+}
+
+QByteArray JsonString(const QString& value) {
+  QByteArray ret = "\"";
+  foreach (const QChar& c, value) {
+    if (c == '"' || c == '\\') {
+      ret += '\\';
+      ret += c.toAscii();
+    } else if (c.unicode() < 0x20 || c.unicode() > 0x7e) {
+      ret += "\\u" + QByteArray::number(c.unicode(), 16).rightJustified(4, '0');
+    } else {
+      ret += c.toAscii();
+    }
+  }
+  ret += "\"";
+  return ret;
+}
+
+} // namespace
+
+
+LatencyStats::LatencyStats() {
+}
+
+const char* LatencyStats::StageName(Stage stage) {
+  switch (stage) {
+    case Stage_Total:      return "total";
+    case Stage_ToWorker:   return "to_worker";
+    case Stage_Worker:     return "worker";
+    case Stage_FromWorker: return "from_worker";
+    case Stage_Parse:      return "parse";
+    default:               return "unknown";
+  }
+}
+
+void LatencyStats::Samples::Add(qint64 value) {
+  if (values_.count() < kMaxSamples) {
+    values_.append(value);
+  } else {
+    values_[next_] = value;
+  }
+  next_ = (next_ + 1) % kMaxSamples;
+  total_count_ ++;
+}
+
+qint64 LatencyStats::Samples::Percentile(const QVector<qint64>& sorted_values,
+                                         int p) {
+  if (sorted_values.isEmpty()) {
+    return 0;
+  }
+
+  // Nearest-rank method.
+  const int rank = (p * sorted_values.count() + 99) / 100;
+  return sorted_values[qBound(0, rank - 1, sorted_values.count() - 1)];
+}
+
+void LatencyStats::AddReply(const QString& request_name,
+                            const MessageTimings& timings) {
+  if (!timings.sent_usec || !timings.received_usec || !timings.parsed_usec) {
+    return;
+  }
+
+  QMutexLocker l(&mutex_);
+  Request& request = requests_[request_name];
+
+  request.stages_[Stage_Total].Add(timings.parsed_usec - timings.sent_usec);
+  request.stages_[Stage_Parse].Add(timings.parsed_usec - timings.received_usec);
+
+  // Older workers don't send their timestamps.
+  if (timings.worker_started_usec && timings.worker_finished_usec) {
+    request.stages_[Stage_ToWorker].Add(
+          timings.worker_started_usec - timings.sent_usec);
+    request.stages_[Stage_Worker].Add(
+          timings.worker_finished_usec - timings.worker_started_usec);
+    request.stages_[Stage_FromWorker].Add(
+          timings.received_usec - timings.worker_finished_usec);
+  }
+}
+
+void LatencyStats::Clear() {
+  QMutexLocker l(&mutex_);
+  requests_.clear();
+}
+
+LatencyStats::RequestMap LatencyStats::Snapshot() const {
+  QMutexLocker l(&mutex_);
+  RequestMap ret = requests_;
+  l.unlock();
+
+  for (RequestMap::iterator it = ret.begin() ; it != ret.end() ; ++it) {
+    for (int i=0 ; i<StageCount ; ++i) {
+      QVector<qint64>& values = it.value().stages_[i].values_;
+      std::sort(values.begin(), values.end());
+    }
+  }
+  return ret;
+}
+
+QString LatencyStats::ToText() const {
+  const RequestMap requests = Snapshot();
+
+  if (requests.isEmpty()) {
+    return QString("No requests have finished yet.\n");
+  }
+
+  QStringList lines;
+  lines << QString("%1 %2 %3   p50 / p95 / p99 (ms)")
+           .arg("request", -24).arg("stage", -12).arg("count", 7);
+
+  for (RequestMap::const_iterator it = requests.begin() ;
+       it != requests.end() ; ++it) {
+    for (int i=0 ; i<StageCount ; ++i) {
+      const Samples& samples = it.value().stages_[i];
+      if (samples.values_.isEmpty()) {
+        continue;
+      }
+
+      QStringList percentiles;
+      for (int j=0 ; j<kPercentileCount ; ++j) {
+        percentiles << FormatMsec(
+              Samples::Percentile(samples.values_, kPercentiles[j]));
+      }
+
+      lines << QString("%1 %2 %3   %4")
+               .arg(i == 0 ? it.key() : QString(), -24)
+               .arg(StageName(Stage(i)), -12)
+               .arg(samples.total_count_, 7)
+               .arg(percentiles.join(" / "));
+    }
+  }
+
+  return lines.join("\n") + "\n";
+}
+
+QByteArray LatencyStats::ToJson() const {
+  const RequestMap requests = Snapshot();
+
+  QList<QByteArray> request_items;
+  for (RequestMap::const_iterator it = requests.begin() ;
+       it != requests.end() ; ++it) {
+    QList<QByteArray> stage_items;
+
+    for (int i=0 ; i<StageCount ; ++i) {
+      const Samples& samples = it.value().stages_[i];
+      if (samples.values_.isEmpty()) {
+        continue;
+      }
+
+      QByteArray item = "      " + JsonString(StageName(Stage(i))) + ": {";
+      item += "\"count\": " + QByteArray::number(samples.total_count_);
+      item += ", \"samples\": " + QByteArray::number(samples.values_.count());
+
+      for (int j=0 ; j<kPercentileCount ; ++j) {
+        item += ", \"p" + QByteArray::number(kPercentiles[j]) + "_usec\": " +
+            QByteArray::number(
+              Samples::Percentile(samples.values_, kPercentiles[j]));
+      }
+
+      item += "}";
+      stage_items << item;
+    }
+
+    QByteArray item = "    " + JsonString(it.key()) + ": {\n";
+    for (int i=0 ; i<stage_items.count() ; ++i) {
+      item += stage_items[i];
+      item += (i == stage_items.count() - 1) ? "\n" : ",\n";
+    }
+    item += "    }";
+    request_items << item;
+  }
+
+  QByteArray ret = "{\n  \"requests\": {\n";
+  for (int i=0 ; i<request_items.count() ; ++i) {
+    ret += request_items[i];
+    ret += (i == request_items.count() - 1) ? "\n" : ",\n";
+  }
+  ret += "  }\n}\n";
+  return ret;
+}
@@ -0,0 +1,83 @@
+#ifndef PYQTC_LATENCYSTATS_H
+#define PYQTC_LATENCYSTATS_H
+
+#include <QByteArray>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+struct MessageTimings;
+
+namespace pyqtc {
+
+// Collects how long each kind of request spends in each stage of its round
+// trip to the worker, and reports percentiles of the most recent samples.
+// Can be used from any thread.
+class LatencyStats {
+public:
+  LatencyStats();
+
+  enum Stage {
+    Stage_Total = 0,  // From sending the request to parsing the response
+    Stage_ToWorker,   // Waiting to be read by the worker
+    Stage_Worker,     // Being handled by the worker
+    Stage_FromWorker, // Waiting for the response to be read
+    Stage_Parse,      // Parsing the response
+
+    StageCount
+  };
+
+  // Only this many of the most recent samples of each request and stage are
+  // kept.
+  static const int kMaxSamples;
+
+  // Adds the stages of a finished reply to the stats.  Stages with missing
+  // timestamps are left out.
+  void AddReply(const QString& request_name, const MessageTimings& timings);
+
+  void Clear();
+
+  // Returns a table of the 50th, 95th and 99th percentile time of each stage
+  // of each request, in milliseconds.
+  QString ToText() const;
+
+  // Returns the same information as a JSON document, along with the number of
+  // samples each percentile was calculated from.
+  QByteArray ToJson() const;
+
+  static const char* StageName(Stage stage);
+
+private:
+  // A ring buffer of durations in microseconds.
+  struct Samples {
+    Samples() : next_(0), total_count_(0) {}
+
+    void Add(qint64 value);
+
+    // Returns the pth percentile of the samples, or 0 if there aren't any.
+    static qint64 Percentile(const QVector<qint64>& sorted_values, int p);
+
+    QVector<qint64> values_;
+    int next_;
+    qint64 total_count_;
+  };
+
+  struct Request {
+    Samples stages_[StageCount];
+  };
+
+  typedef QMap<QString, Request> RequestMap;
+
+  // Returns a copy of the samples so they can be sorted without holding the
+  // lock.
+  RequestMap Snapshot() const;
+
+private:
+  mutable QMutex mutex_;
+  RequestMap requests_;
+};
+
+} // namespace
+
+#endif // PYQTC_LATENCYSTATS_H
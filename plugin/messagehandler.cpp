@@ -22,15 +22,31 @@
 #include "messagehandler.h"
 
 #include <QAbstractSocket>
+#include <QDateTime>
 #include <QLocalSocket>
+#include <QtDebug>
+
+#ifdef Q_OS_UNIX
+# include <sys/time.h>
+#endif
+
+const quint32 _MessageHandlerBase::kCompressedFlag = 0x80000000;
+
+// Compressing small messages saves less than it costs.  Level 1 is about three
+// times faster than the default and still shrinks Python source about 4x.
+const int _MessageHandlerBase::kCompressionThreshold = 16 * 1024;
+const int _MessageHandlerBase::kCompressionLevel = 1;
 
 _MessageHandlerBase::_MessageHandlerBase(QIODevice* device, QObject* parent)
   : QObject(parent),
     device_(NULL),
     flush_abstract_socket_(NULL),
     flush_local_socket_(NULL),
+    compression_enabled_(false),
     reading_protobuf_(false),
-    expected_length_(0) {
+    reading_compressed_(false),
+    expected_length_(0),
+    received_usec_(0) {
   if (device) {
     SetDevice(device);
   }
@@ -42,6 +58,7 @@ void _MessageHandlerBase::SetDevice(QIODevice* device) {
   buffer_.open(QIODevice::ReadWrite);
 
   connect(device, SIGNAL(readyRead()), SLOT(DeviceReadyRead()));
+  connect(device, SIGNAL(destroyed()), SLOT(DeviceDestroyed()));
 
   // Yeah I know.
   if (QAbstractSocket* socket = qobject_cast<QAbstractSocket*>(device)) {
@@ -62,6 +79,8 @@ void _MessageHandlerBase::DeviceReadyRead() {
       QDataStream s(device_);
       s >> expected_length_;
 
+      reading_compressed_ = expected_length_ & kCompressedFlag;
+      expected_length_ &= ~kCompressedFlag;
       reading_protobuf_ = true;
     }
 
@@ -70,8 +89,22 @@ void _MessageHandlerBase::DeviceReadyRead() {
 
     // Did we get everything?
     if (buffer_.size() == expected_length_) {
-      // Parse the message
-      if (!RawMessageArrived(buffer_.data())) {
+      received_usec_ = CurrentTimeUsec();
+
+      const QByteArray data = reading_compressed_ ? qUncompress(buffer_.data())
+                                                  : buffer_.data();
+
+      // qUncompress returns an empty array if the data is corrupt.  That
+      // would parse as an empty message, and nothing compresses an empty
+      // message, so treat it as an error.
+      if (reading_compressed_ && data.isEmpty()) {
+        qWarning() << "Failed to decompress a message - closing the socket";
+        device_->close();
+        return;
+      }
+
+      // Parse the message.
+      if (!RawMessageArrived(data)) {
         device_->close();
         return;
       }
@@ -85,10 +118,36 @@ void _MessageHandlerBase::DeviceReadyRead() {
   }
 }
 
+qint64 _MessageHandlerBase::CurrentTimeUsec() {
+#ifdef Q_OS_UNIX
+  // QDateTime only has millisecond precision.
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return qint64(tv.tv_sec) * 1000000 + tv.tv_usec;
+#else
+  return QDateTime::currentMSecsSinceEpoch() * 1000;
+#endif
+}
+
+void _MessageHandlerBase::DeviceDestroyed() {
+  device_ = NULL;
+}
+
 void _MessageHandlerBase::WriteMessage(const QByteArray& data) {
+  if (!device_) {
+    // The socket was closed and destroyed - any replies were already aborted.
+    return;
+  }
+
   QDataStream s(device_);
-  s << quint32(data.length());
-  s.writeRawData(data.data(), data.length());
+  if (compression_enabled_ && data.length() > kCompressionThreshold) {
+    const QByteArray compressed = qCompress(data, kCompressionLevel);
+    s << (quint32(compressed.length()) | kCompressedFlag);
+    s.writeRawData(compressed.data(), compressed.length());
+  } else {
+    s << quint32(data.length());
+    s.writeRawData(data.data(), data.length());
+  }
 
   // Sorry.
   if (flush_abstract_socket_) {
@@ -98,11 +157,14 @@ void _MessageHandlerBase::WriteMessage(const QByteArray& data) {
   }
 }
 
-_MessageReplyBase::_MessageReplyBase(int id, QObject* parent)
+_MessageReplyBase::_MessageReplyBase(int id, qint64 queued_usec,
+                                     qint64 timeout_usec, QObject* parent)
   : QObject(parent),
     id_(id),
     finished_(false),
-    success_(false)
+    success_(false),
+    queued_usec_(queued_usec),
+    timeout_usec_(timeout_usec)
 {
 }
 
@@ -111,11 +173,37 @@ bool _MessageReplyBase::WaitForFinished() {
   return success_;
 }
 
+bool _MessageReplyBase::WaitForFinished(int timeout_msec) {
+  return semaphore_.tryAcquire(1, timeout_msec);
+}
+
 void _MessageReplyBase::Abort() {
   Q_ASSERT(!finished_);
+  SetFinished(false);
+}
+
+void _MessageReplyBase::SetFinished(bool success) {
   finished_ = true;
-  success_ = false;
+  success_ = success;
 
-  emit Finished(success_);
+  // The requester might not have connected to Finished yet if we're being
+  // called from the handler's thread, so emit it later in our own thread.
+  metaObject()->invokeMethod(this, "EmitFinished", Qt::QueuedConnection);
+
+  // A requester blocked in WaitForFinished may delete the reply as soon as it
+  // wakes up, so this must be the last thing that touches it.
   semaphore_.release();
 }
+
+void _MessageReplyBase::EmitFinished() {
+  emit Finished(success_);
+}
+
+void _MessageReplyBase::SchedulePartialResult() {
+  // Queued like Finished, so the partial results are emitted first.
+  metaObject()->invokeMethod(this, "EmitPartialResult", Qt::QueuedConnection);
+}
+
+void _MessageReplyBase::EmitPartialResult() {
+  emit PartialResult();
+}
@@ -22,12 +22,16 @@
 #ifndef MESSAGEHANDLER_H
 #define MESSAGEHANDLER_H
 
+#include <QAtomicInt>
+#include <QAtomicPointer>
 #include <QBuffer>
+#include <QList>
 #include <QMap>
 #include <QMutex>
 #include <QMutexLocker>
 #include <QObject>
 #include <QSemaphore>
+#include <QString>
 #include <QThread>
 
 class QAbstractSocket;
@@ -40,6 +44,54 @@ class QLocalSocket;
   x.toUtf8().constData(), x.toUtf8().length()
 
 
+// Wall-clock times in microseconds since the epoch at which each stage of a
+// request happened, or 0 if it hasn't happened.  The worker times are only
+// known to subclasses of AbstractMessageHandler that fill them in from the
+// response.
+struct MessageTimings {
+  MessageTimings()
+    : sent_usec(0),
+      worker_started_usec(0),
+      worker_finished_usec(0),
+      received_usec(0),
+      parsed_usec(0) {}
+
+  qint64 sent_usec;
+  qint64 worker_started_usec;
+  qint64 worker_finished_usec;
+  qint64 received_usec;
+  qint64 parsed_usec;
+};
+
+
+// A free list of cleared messages.  Clearing a protobuf keeps the elements of
+// its repeated fields and its submessages allocated, and parsing into it again
+// reuses them, so a response parsed into a recycled message doesn't have to
+// allocate every result and proposal again.  Can be used from any thread.
+template <typename MessageType>
+class MessagePool {
+public:
+  ~MessagePool();
+
+  // Returns an empty message, which is recycled if there is one.
+  static MessageType* Take();
+
+  // Clears the message and keeps it for Take to return later, or deletes it
+  // if the pool is full.
+  static void Recycle(MessageType* message);
+
+private:
+  // Cleared messages still hold their largest ever contents, so only keep a
+  // few.
+  static const int kMaxSize = 4;
+
+  static MessagePool* Instance();
+
+  QMutex mutex_;
+  QList<MessageType*> messages_;
+};
+
+
 // Base QObject for a reply future class that is returned immediately for
 // requests that will occur in the background.  Similar to QNetworkReply.
 // Use MessageReply instead.
@@ -47,27 +99,77 @@ class _MessageReplyBase : public QObject {
   Q_OBJECT
 
 public:
-  _MessageReplyBase(int id, QObject* parent = 0);
+  _MessageReplyBase(int id, qint64 queued_usec = 0, qint64 timeout_usec = 0,
+                    QObject* parent = 0);
 
   int id() const { return id_; }
   bool is_finished() const { return finished_; }
   bool is_successful() const { return success_; }
 
-  // Waits for the reply to finish by waiting on a semaphore.  Never call this
-  // from the MessageHandler's thread or it will block forever.
+  // A name for the kind of request this is a reply to, used when collecting
+  // statistics.
+  const QString& request_name() const { return request_name_; }
+  void set_request_name(const QString& name) { request_name_ = name; }
+
+  // Set by the handler as the request is sent and the reply arrives.
+  const MessageTimings& timings() const { return timings_; }
+  MessageTimings* mutable_timings() { return &timings_; }
+
+  // The wall-clock time in microseconds since the epoch at which the request
+  // was queued to be sent.
+  qint64 queued_usec() const { return queued_usec_; }
+
+  // How long the other end can spend handling the request, or 0 if it can
+  // take as long as it likes.
+  qint64 timeout_usec() const { return timeout_usec_; }
+
+  // Waits for the reply to finish by waiting on a semaphore.  Can be called
+  // from any thread except the one the MessageHandler lives in.
   // Returns true if the call was successful.
   bool WaitForFinished();
 
+  // Like WaitForFinished but gives up after timeout_msec.  Returns true if the
+  // reply finished, whether or not the call was successful.
+  bool WaitForFinished(int timeout_msec);
+
+  // Can be called from any thread.
   void Abort();
 
 signals:
+  // Always emitted in the thread the reply belongs to, after control returns
+  // to its event loop, so it is safe to connect to this signal after sending
+  // the request.
   void Finished(bool success);
 
+  // Emitted like Finished for each partial response that arrives before the
+  // last one.  All the partial responses are emitted before Finished.
+  void PartialResult();
+
+protected:
+  // Marks the reply as finished, wakes up WaitForFinished and schedules the
+  // Finished signal.  Can be called from any thread.
+  void SetFinished(bool success);
+
+  // Schedules the PartialResult signal.  Can be called from any thread.
+  void SchedulePartialResult();
+
+private slots:
+  void EmitFinished();
+  void EmitPartialResult();
+
 protected:
   int id_;
   bool finished_;
   bool success_;
 
+  // Guards the partial responses in MessageReply.
+  QMutex partial_mutex_;
+
+  QString request_name_;
+  MessageTimings timings_;
+  qint64 queued_usec_;
+  qint64 timeout_usec_;
+
   QSemaphore semaphore_;
 };
 
@@ -77,14 +179,32 @@ protected:
 template <typename MessageType>
 class MessageReply : public _MessageReplyBase {
 public:
-  MessageReply(int id, QObject* parent = 0);
+  MessageReply(int id, qint64 queued_usec = 0, qint64 timeout_usec = 0,
+               QObject* parent = 0);
+  ~MessageReply();
+
+  // Returns an empty message until the reply has arrived.
+  const MessageType& message() const {
+    return message_ ? *message_ : MessageType::default_instance();
+  }
 
-  const MessageType& message() const { return message_; }
+  // Takes ownership of the message.  It is given back to the MessagePool when
+  // the reply is deleted.
+  void SetReply(MessageType* message);
 
-  void SetReply(const MessageType& message);
+  // Returns the partial responses that have arrived and haven't been taken
+  // yet, in the order they arrived.  The last response only has what came
+  // after them.  The caller owns the messages and should give them back to
+  // the MessagePool.  Can be called from any thread.
+  QList<MessageType*> TakePartialResults();
+
+  // Takes ownership of a partial response and schedules the PartialResult
+  // signal.
+  void AddPartialResult(MessageType* message);
 
 private:
-  MessageType message_;
+  MessageType* message_;
+  QList<MessageType*> partial_results_;
 };
 
 
@@ -101,9 +221,24 @@ public:
 
   void SetDevice(QIODevice* device);
 
+  // Messages larger than kCompressionThreshold bytes are written compressed
+  // once this is enabled - only do that when the other end can read them.
+  // Compressed messages are always read.  Must be called from the thread the
+  // handler lives in.
+  void SetCompressionEnabled(bool enabled) { compression_enabled_ = enabled; }
+
+  // The top bit of a message's length is set if it's compressed.
+  static const quint32 kCompressedFlag;
+  static const int kCompressionThreshold;
+  static const int kCompressionLevel;
+
+  // Returns the current wall-clock time in microseconds since the epoch.
+  static qint64 CurrentTimeUsec();
+
 protected slots:
   void WriteMessage(const QByteArray& data);
   void DeviceReadyRead();
+  void DeviceDestroyed();
   virtual void SocketClosed() {}
 
 protected:
@@ -117,15 +252,26 @@ protected:
   FlushAbstractSocket flush_abstract_socket_;
   FlushLocalSocket flush_local_socket_;
 
+  bool compression_enabled_;
+
   bool reading_protobuf_;
+  bool reading_compressed_;
   quint32 expected_length_;
   QBuffer buffer_;
+
+  // When the last byte of the message being passed to RawMessageArrived was
+  // read.
+  qint64 received_usec_;
 };
 
 
 // Reads and writes uint32 length encoded MessageType messages to a socket.
 // You should subclass this and implement the MessageArrived(MessageType)
-// method.
+// method.  Responses with partial() set are added to their reply, which stays
+// pending until a response without it arrives.  Messages are parsed in the
+// thread the handler lives in, so it can be moved to a dedicated I/O thread -
+// replies are then finished from that thread and only their Finished signal is
+// delivered to the requester's thread.
 template <typename MessageType>
 class AbstractMessageHandler : public _MessageHandlerBase {
 public:
@@ -144,29 +290,78 @@ public:
   // Creates a new reply future for the request with the next sequential ID,
   // and sets the request's ID to the ID of the reply.  When a reply arrives
   // for this request the reply is triggered automatically and MessageArrived
-  // is NOT called.  Can be called from any thread.
-  ReplyType* NewReply(MessageType* message);
+  // is NOT called.  If timeout_msec is not -1 the reply is overdue if it
+  // hasn't arrived that long after the other end started handling the
+  // request.  Can be called from any thread.
+  ReplyType* NewReply(MessageType* message, int timeout_msec = -1);
 
   // Same as NewReply, except the message is sent as well.  Can be called from
   // any thread.
-  ReplyType* SendMessageWithReply(MessageType* message);
+  ReplyType* SendMessageWithReply(MessageType* message, int timeout_msec = -1);
 
   // Sets the "id" field of reply to the same as the request, and sends the
   // reply on the socket.  Used on the worker side.
   void SendReply(const MessageType& request, MessageType* reply);
 
+  // Returns true if any replies haven't arrived yet.  Must be called from the
+  // thread the handler lives in.
+  bool HasPendingReplies();
+
+  // Returns true if the request the other end is handling has taken longer
+  // than its timeout - the other end has probably hung.  The other end is
+  // assumed to handle requests one at a time in the order they were sent, so
+  // a request's clock only starts when the one before it has finished.  Must
+  // be called from the thread the handler lives in.
+  bool HasOverdueReplies();
+
 protected:
   // Called when a message is received from the socket.
   virtual void MessageArrived(const MessageType& message) {}
 
+  // Called when a reply to one of our requests is received, just before the
+  // reply is finished.  Runs in the thread the handler lives in.
+  virtual void ReplyArrived(const MessageType& message, ReplyType* reply) {}
+
   // _MessageHandlerBase
   bool RawMessageArrived(const QByteArray& data);
   void SocketClosed();
 
 private:
-  QMutex mutex_;
-  int next_id_;
-  QMap<int, ReplyType*> pending_replies_;
+  // Removes the pending reply with this ID from the table and returns it, or
+  // returns NULL if there isn't one.
+  ReplyType* TakeReply(int id);
+
+  // Returns the pending reply with this ID without removing it, or NULL.
+  // Must be called from the thread the handler lives in.
+  ReplyType* PendingReply(int id);
+
+  // Returns the pending reply with the lowest ID, or NULL.  Must be called
+  // from the thread the handler lives in.
+  ReplyType* OldestPendingReply();
+
+private:
+  // Pending replies are stored in a fixed table indexed by the low bits of
+  // their ID - the rest of the ID acts as a generation count that tells apart
+  // replies sharing a slot.  Slots are claimed and released with atomic
+  // operations so requests and responses in different threads don't contend
+  // on a lock.  A reply whose slot is still taken by an older request goes in
+  // overflow_replies_ instead.
+  // Each slot's reply ID is kept in slot_ids_, so finding a reply never
+  // touches a reply that another thread might take and delete meanwhile.  The
+  // ID is stored after the reply and set back to 0 by whoever takes it, so
+  // only one thread can win a reply.
+  static const int kSlotCount = 256;
+
+  QAtomicInt next_id_;
+  QAtomicInt closed_;
+  QAtomicPointer<ReplyType> slots_[kSlotCount];
+  QAtomicInt slot_ids_[kSlotCount];
+
+  QMutex overflow_mutex_;
+  QMap<int, ReplyType*> overflow_replies_;
+
+  // When the last reply arrived.  Only used in the handler's thread.
+  qint64 last_reply_usec_;
 };
 
 
@@ -174,7 +369,9 @@ template<typename MessageType>
 AbstractMessageHandler<MessageType>::AbstractMessageHandler(
     QIODevice* device, QObject* parent)
   : _MessageHandlerBase(device, parent),
-    next_id_(1)
+    next_id_(1),
+    closed_(0),
+    last_reply_usec_(0)
 {
 }
 
@@ -202,22 +399,32 @@ void AbstractMessageHandler<MessageType>::SendReply(const MessageType& request,
 
 template<typename MessageType>
 bool AbstractMessageHandler<MessageType>::RawMessageArrived(const QByteArray& data) {
-  MessageType message;
-  if (!message.ParseFromArray(data.constData(), data.size())) {
+  MessageType* message = MessagePool<MessageType>::Take();
+  if (!message->ParseFromArray(data.constData(), data.size())) {
+    MessagePool<MessageType>::Recycle(message);
     return false;
   }
-
-  ReplyType* reply = NULL;
-  {
-    QMutexLocker l(&mutex_);
-    reply = pending_replies_.take(message.id());
-  }
-
-  if (reply) {
-    // This is a reply to a message that we created earlier.
+  const qint64 parsed_usec = CurrentTimeUsec();
+
+  // More responses will follow a partial one, so its reply stays pending.
+  const bool partial = message->partial();
+  ReplyType* reply = partial ? PendingReply(message->id())
+                             : TakeReply(message->id());
+
+  if (reply && partial) {
+    reply->AddPartialResult(message);
+  } else if (reply) {
+    // This is a reply to a message that we created earlier.  The other end
+    // starts on its next request now.
+    last_reply_usec_ = received_usec_;
+    reply->mutable_timings()->received_usec = received_usec_;
+    reply->mutable_timings()->parsed_usec = parsed_usec;
+
+    ReplyArrived(*message, reply);
     reply->SetReply(message);
   } else {
-    MessageArrived(message);
+    MessageArrived(*message);
+    MessagePool<MessageType>::Recycle(message);
   }
 
   return true;
@@ -226,27 +433,116 @@ bool AbstractMessageHandler<MessageType>::RawMessageArrived(const QByteArray& da
 template<typename MessageType>
 typename AbstractMessageHandler<MessageType>::ReplyType*
 AbstractMessageHandler<MessageType>::NewReply(
-    MessageType* message) {
-  ReplyType* reply = NULL;
-
-  {
-    QMutexLocker l(&mutex_);
+    MessageType* message, int timeout_msec) {
+  const int id = next_id_.fetchAndAddRelaxed(1);
+  const qint64 timeout_usec = timeout_msec == -1 ? 0 :
+      qint64(timeout_msec) * 1000;
+  ReplyType* reply = new ReplyType(id, CurrentTimeUsec(), timeout_usec);
+
+  const int slot = id & (kSlotCount - 1);
+  if (slots_[slot].testAndSetOrdered(NULL, reply)) {
+    slot_ids_[slot].fetchAndStoreOrdered(id);
+  } else {
+    QMutexLocker l(&overflow_mutex_);
+    overflow_replies_[id] = reply;
+  }
 
-    const int id = next_id_ ++;
-    reply = new ReplyType(id);
-    pending_replies_[id] = reply;
+  if (closed_) {
+    // The socket has gone away, so this reply will never arrive.  SocketClosed
+    // might have aborted it already, in which case it's not in the table.
+    if (TakeReply(id) == reply) {
+      reply->Abort();
+    }
   }
 
-  message->set_id(reply->id());
+  message->set_id(id);
   return reply;
 }
 
+template<typename MessageType>
+typename AbstractMessageHandler<MessageType>::ReplyType*
+AbstractMessageHandler<MessageType>::TakeReply(int id) {
+  const int slot = id & (kSlotCount - 1);
+
+  // Clearing the ID makes the reply ours, even if another thread is looking
+  // for it too.
+  if (slot_ids_[slot].testAndSetOrdered(id, 0)) {
+    return slots_[slot].fetchAndStoreOrdered(NULL);
+  }
+
+  QMutexLocker l(&overflow_mutex_);
+  return overflow_replies_.take(id);
+}
+
+template<typename MessageType>
+typename AbstractMessageHandler<MessageType>::ReplyType*
+AbstractMessageHandler<MessageType>::PendingReply(int id) {
+  // Replies are only finished after they're taken out of the table, and only
+  // this thread takes them apart from NewReply after the socket has closed.
+  // So the reply we return stays pending while this thread uses it.
+  const int slot = id & (kSlotCount - 1);
+  if (slot_ids_[slot] == id) {
+    return slots_[slot];
+  }
+
+  QMutexLocker l(&overflow_mutex_);
+  return overflow_replies_.value(id);
+}
+
+template<typename MessageType>
+typename AbstractMessageHandler<MessageType>::ReplyType*
+AbstractMessageHandler<MessageType>::OldestPendingReply() {
+  int oldest_id = 0;
+  int oldest_slot = -1;
+
+  for (int i=0 ; i<kSlotCount ; ++i) {
+    const int id = slot_ids_[i];
+    if (id && (!oldest_id || id < oldest_id)) {
+      oldest_id = id;
+      oldest_slot = i;
+    }
+  }
+
+  // The map is sorted by ID.
+  QMutexLocker l(&overflow_mutex_);
+  if (!overflow_replies_.isEmpty() &&
+      (!oldest_id || overflow_replies_.begin().key() < oldest_id)) {
+    return overflow_replies_.begin().value();
+  }
+  return oldest_slot == -1 ? NULL : slots_[oldest_slot];
+}
+
+template<typename MessageType>
+bool AbstractMessageHandler<MessageType>::HasPendingReplies() {
+  for (int i=0 ; i<kSlotCount ; ++i) {
+    if (slots_[i]) {
+      return true;
+    }
+  }
+
+  QMutexLocker l(&overflow_mutex_);
+  return !overflow_replies_.isEmpty();
+}
+
+template<typename MessageType>
+bool AbstractMessageHandler<MessageType>::HasOverdueReplies() {
+  // The other requests are still queued behind the oldest one.
+  const ReplyType* reply = OldestPendingReply();
+  if (!reply || !reply->timeout_usec()) {
+    return false;
+  }
+
+  const qint64 started_usec = qMax(reply->queued_usec(), last_reply_usec_);
+  return started_usec + reply->timeout_usec() < CurrentTimeUsec();
+}
+
 template<typename MessageType>
 typename AbstractMessageHandler<MessageType>::ReplyType*
 AbstractMessageHandler<MessageType>::SendMessageWithReply(
-    MessageType* message) {
-  ReplyType* reply = NewReply(message);
+    MessageType* message, int timeout_msec) {
+  ReplyType* reply = NewReply(message, timeout_msec);
 
+  reply->mutable_timings()->sent_usec = CurrentTimeUsec();
   SendMessageAsync(*message);
 
   return reply;
@@ -254,30 +550,109 @@ AbstractMessageHandler<MessageType>::SendMessageWithReply(
 
 template<typename MessageType>
 void AbstractMessageHandler<MessageType>::SocketClosed() {
-  QMutexLocker l(&mutex_);
+  closed_.fetchAndStoreOrdered(1);
+
+  for (int i=0 ; i<kSlotCount ; ++i) {
+    // A NewReply that hasn't stored its ID yet will see closed_ and abort its
+    // own reply.
+    if (slot_ids_[i].fetchAndStoreOrdered(0)) {
+      ReplyType* reply = slots_[i].fetchAndStoreOrdered(NULL);
+      if (reply) {
+        reply->Abort();
+      }
+    }
+  }
 
-  foreach (ReplyType* reply, pending_replies_) {
+  QMutexLocker l(&overflow_mutex_);
+  foreach (ReplyType* reply, overflow_replies_) {
     reply->Abort();
   }
-  pending_replies_.clear();
+  overflow_replies_.clear();
 }
 
 template<typename MessageType>
-MessageReply<MessageType>::MessageReply(int id, QObject* parent)
-  : _MessageReplyBase(id, parent)
+MessageReply<MessageType>::MessageReply(int id, qint64 queued_usec,
+                                        qint64 timeout_usec, QObject* parent)
+  : _MessageReplyBase(id, queued_usec, timeout_usec, parent),
+    message_(NULL)
 {
 }
 
 template<typename MessageType>
-void MessageReply<MessageType>::SetReply(const MessageType& message) {
+MessageReply<MessageType>::~MessageReply() {
+  if (message_) {
+    MessagePool<MessageType>::Recycle(message_);
+  }
+  foreach (MessageType* message, partial_results_) {
+    MessagePool<MessageType>::Recycle(message);
+  }
+}
+
+template<typename MessageType>
+void MessageReply<MessageType>::SetReply(MessageType* message) {
   Q_ASSERT(!finished_);
 
-  message_.MergeFrom(message);
-  finished_ = true;
-  success_ = true;
+  message_ = message;
+  SetFinished(true);
+}
+
+template<typename MessageType>
+QList<MessageType*> MessageReply<MessageType>::TakePartialResults() {
+  QMutexLocker l(&partial_mutex_);
+
+  QList<MessageType*> ret = partial_results_;
+  partial_results_.clear();
+  return ret;
+}
 
-  emit Finished(success_);
-  semaphore_.release();
+template<typename MessageType>
+void MessageReply<MessageType>::AddPartialResult(MessageType* message) {
+  Q_ASSERT(!finished_);
+
+  {
+    QMutexLocker l(&partial_mutex_);
+    partial_results_ << message;
+  }
+  SchedulePartialResult();
+}
+
+
+template<typename MessageType>
+MessagePool<MessageType>* MessagePool<MessageType>::Instance() {
+  static MessagePool<MessageType> sInstance;
+  return &sInstance;
+}
+
+template<typename MessageType>
+MessagePool<MessageType>::~MessagePool() {
+  qDeleteAll(messages_);
+}
+
+template<typename MessageType>
+MessageType* MessagePool<MessageType>::Take() {
+  MessagePool<MessageType>* pool = Instance();
+  {
+    QMutexLocker l(&pool->mutex_);
+    if (!pool->messages_.isEmpty()) {
+      return pool->messages_.takeLast();
+    }
+  }
+  return new MessageType;
+}
+
+template<typename MessageType>
+void MessagePool<MessageType>::Recycle(MessageType* message) {
+  message->Clear();
+
+  MessagePool<MessageType>* pool = Instance();
+  {
+    QMutexLocker l(&pool->mutex_);
+    if (pool->messages_.count() < kMaxSize) {
+      pool->messages_ << message;
+      return;
+    }
+  }
+  delete message;
 }
 
 #endif // MESSAGEHANDLER_H
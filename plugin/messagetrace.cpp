@@ -0,0 +1,107 @@
+#include "messagehandler.h"
+#include "messagetrace.h"
+
+#include <QMutexLocker>
+#include <QtDebug>
+
+using namespace pyqtc;
+
+namespace pyqtc {
+namespace messagetrace {
+  const quint32 kMagic = 0x70797463; // "pytc"
+  const quint32 kVersion = 1;
+}
+}
+
+
+MessageTraceWriter::MessageTraceWriter()
+  : start_usec_(0)
+{
+}
+
+bool MessageTraceWriter::Open(const QString& filename) {
+  QMutexLocker l(&mutex_);
+
+  file_.setFileName(filename);
+  if (!file_.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    qWarning() << "Could not create trace file" << filename;
+    return false;
+  }
+
+  stream_.setDevice(&file_);
+  stream_ << messagetrace::kMagic << messagetrace::kVersion;
+  start_usec_ = _MessageHandlerBase::CurrentTimeUsec();
+  return true;
+}
+
+void MessageTraceWriter::Record(const QByteArray& data) {
+  QMutexLocker l(&mutex_);
+  if (!file_.isOpen()) {
+    return;
+  }
+
+  stream_ << qint64(_MessageHandlerBase::CurrentTimeUsec() - start_usec_)
+          << quint32(data.length());
+  stream_.writeRawData(data.constData(), data.length());
+
+  // Flush every message so the trace is usable even if we crash.
+  file_.flush();
+}
+
+MessageTraceWriter* MessageTraceWriter::FromEnvironment() {
+  static MessageTraceWriter* sWriter = NULL;
+  static bool sInitialised = false;
+  static QMutex sMutex;
+
+  QMutexLocker l(&sMutex);
+  if (!sInitialised) {
+    sInitialised = true;
+
+    const QString filename = QString::fromLocal8Bit(qgetenv("PYQTC_TRACE_FILE"));
+    if (!filename.isEmpty()) {
+      sWriter = new MessageTraceWriter;
+      if (!sWriter->Open(filename)) {
+        delete sWriter;
+        sWriter = NULL;
+      }
+    }
+  }
+  return sWriter;
+}
+
+
+MessageTraceReader::MessageTraceReader() {
+}
+
+bool MessageTraceReader::Open(const QString& filename) {
+  file_.setFileName(filename);
+  if (!file_.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+
+  stream_.setDevice(&file_);
+
+  quint32 magic = 0;
+  quint32 version = 0;
+  stream_ >> magic >> version;
+
+  return stream_.status() == QDataStream::Ok &&
+         magic == messagetrace::kMagic &&
+         version == messagetrace::kVersion;
+}
+
+bool MessageTraceReader::ReadNext(qint64* usec, QByteArray* data) {
+  if (stream_.atEnd()) {
+    return false;
+  }
+
+  quint32 length = 0;
+  stream_ >> *usec >> length;
+
+  data->resize(length);
+  if (stream_.readRawData(data->data(), length) != int(length)) {
+    return false;
+  }
+
+  return stream_.status() == QDataStream::Ok;
+}
@@ -0,0 +1,65 @@
+#ifndef PYQTC_MESSAGETRACE_H
+#define PYQTC_MESSAGETRACE_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QFile>
+#include <QMutex>
+#include <QString>
+
+namespace pyqtc {
+
+// A trace file is a header followed by one record for each message:
+//   quint32 kMagic, quint32 kVersion
+//   { qint64 usec since the trace started, quint32 length, data }...
+// Everything is big-endian, like the messages on the socket.
+namespace messagetrace {
+  extern const quint32 kMagic;
+  extern const quint32 kVersion;
+}
+
+
+// Appends serialized messages and the time they were sent to a trace file.
+// Can be shared between handlers in any thread.
+class MessageTraceWriter {
+public:
+  MessageTraceWriter();
+
+  // Creates the trace file, overwriting any existing file.
+  bool Open(const QString& filename);
+
+  void Record(const QByteArray& data);
+
+  // Returns a writer for the file named by $PYQTC_TRACE_FILE, or NULL if the
+  // variable isn't set or the file couldn't be created.  Always returns the
+  // same writer.
+  static MessageTraceWriter* FromEnvironment();
+
+private:
+  QMutex mutex_;
+  QFile file_;
+  QDataStream stream_;
+  qint64 start_usec_;
+};
+
+
+// Reads back the messages in a trace file.
+class MessageTraceReader {
+public:
+  MessageTraceReader();
+
+  // Opens the file and checks its header.
+  bool Open(const QString& filename);
+
+  // Reads the next message.  Returns false at the end of the file, or if the
+  // file is truncated.
+  bool ReadNext(qint64* usec, QByteArray* data);
+
+private:
+  QFile file_;
+  QDataStream stream_;
+};
+
+} // namespace
+
+#endif // PYQTC_MESSAGETRACE_H
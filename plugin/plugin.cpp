@@ -2,6 +2,8 @@
 #include "constants.h"
 #include "completionassist.h"
 #include "hoverhandler.h"
+#include "latencystats.h"
+#include "messagetrace.h"
 #include "plugin.h"
 #include "projects.h"
 #include "pythoneditor.h"
@@ -17,12 +19,17 @@
 #include <coreplugin/helpmanager.h>
 #include <coreplugin/icore.h>
 #include <coreplugin/icontext.h>
+#include <coreplugin/messagemanager.h>
 #include <coreplugin/mimedatabase.h>
 
 #include <QAction>
+#include <QFile>
+#include <QFileDialog>
 #include <QMessageBox>
 #include <QMainWindow>
 #include <QMenu>
+#include <QTextDocument>
+#include <QThread>
 #include <QtHelp/QHelpEngineCore>
 
 #include <QtDebug>
@@ -37,21 +44,48 @@ inline void InitResources() {
   Q_INIT_RESOURCE(pyqtc);
 }
 
+static void StartWorkerPool(WorkerPool<WorkerClient>* pool, QThread* thread,
+                            const QString& server_name) {
+  pool->moveToThread(thread);
+  pool->SetExecutableName("python");
+  pool->SetExecutableArguments(QStringList() << config::kWorkerZipPath);
+  pool->SetWorkerCount(1);
+  pool->SetLocalServerName(server_name);
+#ifdef Q_OS_UNIX
+  // Fork workers from a zygote that has already imported rope, so restarting
+  // a worker after a crash or a hang is almost instant.
+  pool->SetZygoteEnabled(true);
+#endif
+  pool->Start();
+}
+
 
 Plugin::Plugin()
-  : worker_pool_(new WorkerPool<WorkerClient>(this)),
-    icons_(new PythonIcons)
+  : io_thread_(new QThread(this)),
+    worker_pool_(new WorkerPool<WorkerClient>),
+    index_worker_pool_(new WorkerPool<WorkerClient>),
+    icons_(new PythonIcons),
+    hover_handler_(NULL)
 {
   InitResources();
 
-  worker_pool_->SetExecutableName("python");
-  worker_pool_->SetExecutableArguments(QStringList() << config::kWorkerZipPath);
-  worker_pool_->SetWorkerCount(1);
-  worker_pool_->SetLocalServerName("pyqtc");
-  worker_pool_->Start();
+  io_thread_->start();
+
+  // Only the editor's requests are traced - the index worker's rebuilds would
+  // swamp them.
+  worker_pool_->SetHandlerTrace(MessageTraceWriter::FromEnvironment());
+  StartWorkerPool(worker_pool_, io_thread_, "pyqtc");
+  StartWorkerPool(index_worker_pool_, io_thread_, "pyqtc-index");
 }
 
 Plugin::~Plugin() {
+  // Delete the worker pool in its own thread.  Deferred deletes are processed
+  // when the thread finishes.
+  worker_pool_->deleteLater();
+  index_worker_pool_->deleteLater();
+  io_thread_->quit();
+  io_thread_->wait();
+
   delete icons_;
 }
 
@@ -65,9 +99,10 @@ bool Plugin::initialize(const QStringList& arguments, QString* errorString) {
         QLatin1String(":/pythoneditor/PythonEditor.mimetypes.xml"), errorString))
       return false;
 
-  addAutoReleasedObject(new Projects(worker_pool_));
+  addAutoReleasedObject(new Projects(worker_pool_, index_worker_pool_));
   addAutoReleasedObject(new CompletionAssistProvider(worker_pool_, icons_));
-  addAutoReleasedObject(new HoverHandler(worker_pool_));
+  hover_handler_ = new HoverHandler(worker_pool_);
+  addAutoReleasedObject(hover_handler_);
   addAutoReleasedObject(new PythonEditorFactory);
   addAutoReleasedObject(new PythonClassFilter(worker_pool_, icons_));
   addAutoReleasedObject(new PythonFunctionFilter(worker_pool_, icons_));
@@ -84,6 +119,21 @@ bool Plugin::initialize(const QStringList& arguments, QString* errorString) {
   connect(action, SIGNAL(triggered()), this, SLOT(JumpToDefinition()));
   menu->addAction(cmd);
 
+  action = new QAction(tr("Show Object Database Statistics"), this);
+  cmd = am->registerAction(action, constants::kShowMemoryStatsId, context);
+  connect(action, SIGNAL(triggered()), this, SLOT(ShowMemoryStats()));
+  menu->addAction(cmd);
+
+  action = new QAction(tr("Show Request Latency Statistics"), this);
+  cmd = am->registerAction(action, constants::kShowLatencyStatsId, context);
+  connect(action, SIGNAL(triggered()), this, SLOT(ShowLatencyStats()));
+  menu->addAction(cmd);
+
+  action = new QAction(tr("Save Request Latency Statistics..."), this);
+  cmd = am->registerAction(action, constants::kSaveLatencyStatsId, context);
+  connect(action, SIGNAL(triggered()), this, SLOT(SaveLatencyStats()));
+  menu->addAction(cmd);
+
   return true;
 }
 
@@ -104,11 +154,20 @@ void Plugin::JumpToDefinition() {
     return;
   }
 
+  const QString file_path = editor->file()->fileName();
+  const QString source_text = editor->document()->toPlainText();
+
+  // The definition was probably looked up when the user hovered over it.
+  pb::DefinitionLocationResponse cached;
+  if (hover_handler_->CachedDefinitionLocation(
+        file_path, source_text, editor->position(), &cached)) {
+    GoToDefinition(editor, cached);
+    return;
+  }
+
   WorkerClient::ReplyType* reply =
       worker_pool_->NextHandler()->DefinitionLocation(
-        editor->file()->fileName(),
-        editor->document()->toPlainText(),
-        editor->position());
+        file_path, source_text, editor->position());
 
   NewClosure(reply, SIGNAL(Finished(bool)),
              this, SLOT(JumpToDefinitionFinished(WorkerClient::ReplyType*)),
@@ -129,9 +188,11 @@ void Plugin::JumpToDefinitionFinished(WorkerClient::ReplyType* reply) {
     return;
   }
 
-  const pb::DefinitionLocationResponse& response =
-      reply->message().definition_location_response();
+  GoToDefinition(editor, reply->message().definition_location_response());
+}
 
+void Plugin::GoToDefinition(PythonEditorWidget* editor,
+                            const pb::DefinitionLocationResponse& response) {
   if (response.has_line()) {
     if (response.has_file_path()) {
       editor->openEditorAt(response.file_path(), response.line());
@@ -141,5 +202,99 @@ void Plugin::JumpToDefinitionFinished(WorkerClient::ReplyType* reply) {
   }
 }
 
+void Plugin::ShowMemoryStats() {
+  // The index worker has its own copy of each project.
+  WorkerClient::ReplyType* reply = worker_pool_->NextHandler()->MemoryStats();
+  WorkerClient::ReplyType* index_reply =
+      index_worker_pool_->NextHandler()->MemoryStats();
+
+  NewClosure(reply, SIGNAL(Finished(bool)),
+             this, SLOT(ShowMemoryStatsFinished(WorkerClient::ReplyType*,
+                                                WorkerClient::ReplyType*)),
+             reply, index_reply);
+}
+
+void Plugin::ShowMemoryStatsFinished(WorkerClient::ReplyType* reply,
+                                     WorkerClient::ReplyType* index_reply) {
+  if (!index_reply->is_finished()) {
+    // Come back when the other one has finished too.
+    NewClosure(index_reply, SIGNAL(Finished(bool)),
+               this, SLOT(ShowMemoryStatsFinished(WorkerClient::ReplyType*,
+                                                  WorkerClient::ReplyType*)),
+               reply, index_reply);
+    return;
+  }
+
+  reply->deleteLater();
+  index_reply->deleteLater();
+
+  QStringList sections;
+  sections << MemoryStatsText(tr("Editor worker"), reply)
+           << MemoryStatsText(tr("Index worker"), index_reply);
+
+  QMessageBox::information(Core::ICore::instance()->mainWindow(),
+                           tr("Object Database Statistics"),
+                           sections.join("<br><br>"));
+}
+
+QString Plugin::MemoryStatsText(const QString& title,
+                                const WorkerClient::ReplyType* reply) {
+  QStringList lines;
+  lines << tr("<h3>%1</h3>").arg(title);
+
+  if (!reply->is_successful()) {
+    lines << tr("The worker didn't reply.");
+    return lines.join("");
+  }
+
+  QStringList projects;
+  foreach (const pb::MemoryStatsResponse_Project& project,
+           reply->message().memory_stats_response().project()) {
+    projects << tr("<b>%1</b><br>"
+                   "%2 files (%3 loaded), %4 scopes, %5 calls, %6 names<br>"
+                   "%7 KB on disk").arg(
+          Qt::escape(project.project_root()),
+          QString::number(project.file_count()),
+          QString::number(project.loaded_file_count()),
+          QString::number(project.scope_count()),
+          QString::number(project.call_info_count()),
+          QString::number(project.per_name_count()),
+          QString::number(project.stored_size() / 1024));
+  }
+
+  if (projects.isEmpty()) {
+    projects << tr("No projects are open.");
+  }
+
+  lines << projects.join("<br><br>");
+  return lines.join("");
+}
+
+void Plugin::ShowLatencyStats() {
+  Core::ICore::instance()->messageManager()->printToOutputPane(
+        tr("Python request latencies:\n") +
+        WorkerClient::latency_stats()->ToText(), true);
+}
+
+void Plugin::SaveLatencyStats() {
+  const QString filename = QFileDialog::getSaveFileName(
+        Core::ICore::instance()->mainWindow(),
+        tr("Save Request Latency Statistics"), QString(),
+        tr("JSON files (*.json)"));
+  if (filename.isEmpty()) {
+    return;
+  }
+
+  QFile file(filename);
+  if (!file.open(QIODevice::WriteOnly)) {
+    QMessageBox::warning(Core::ICore::instance()->mainWindow(),
+                         tr("Save Request Latency Statistics"),
+                         tr("Could not write to %1").arg(filename));
+    return;
+  }
+
+  file.write(WorkerClient::latency_stats()->ToJson());
+}
+
 Q_EXPORT_PLUGIN2(pyqtc, Plugin)
 
@@ -6,8 +6,12 @@
 
 #include <extensionsystem/iplugin.h>
 
+class QThread;
+
 namespace pyqtc {
 
+class HoverHandler;
+class PythonEditorWidget;
 class PythonIcons;
 
 class Plugin : public ExtensionSystem::IPlugin {
@@ -25,11 +29,36 @@ private slots:
   void JumpToDefinition();
   void JumpToDefinitionFinished(WorkerClient::ReplyType* reply);
 
+  void ShowMemoryStats();
+  void ShowMemoryStatsFinished(WorkerClient::ReplyType* reply,
+                               WorkerClient::ReplyType* index_reply);
+
+  void ShowLatencyStats();
+  void SaveLatencyStats();
+
 private:
   static const char* kJumpToDefinition;
 
+  // Opens the definition's location in the editor.
+  static void GoToDefinition(PythonEditorWidget* editor,
+                             const pb::DefinitionLocationResponse& response);
+
+  // Formats one worker's MemoryStatsResponse for ShowMemoryStatsFinished.
+  static QString MemoryStatsText(const QString& title,
+                                 const WorkerClient::ReplyType* reply);
+
+  // The worker pool and all its sockets live in this thread, so responses are
+  // read and parsed without blocking the GUI.
+  QThread* io_thread_;
   WorkerPool<WorkerClient>* worker_pool_;
+
+  // A single worker that does all the writes to the symbol index, so rebuilds
+  // never run concurrently.  Searches are still handled by worker_pool_.
+  WorkerPool<WorkerClient>* index_worker_pool_;
   PythonIcons* icons_;
+
+  // Owned by the plugin manager.
+  HoverHandler* hover_handler_;
 };
 
 } // namespace pyqtc
@@ -1,8 +1,10 @@
 #include "projects.h"
 
-#include "closure.h"
+#include "constants.h"
 #include "messagehandler.h"
 
+#include <coreplugin/icore.h>
+#include <coreplugin/progressmanager/progressmanager.h>
 #include <projectexplorer/project.h>
 #include <projectexplorer/projectexplorer.h>
 #include <projectexplorer/session.h>
@@ -13,9 +15,12 @@
 using namespace pyqtc;
 
 
-Projects::Projects(WorkerPool<WorkerClient>* worker_pool, QObject* parent)
+Projects::Projects(WorkerPool<WorkerClient>* worker_pool,
+                   WorkerPool<WorkerClient>* index_worker_pool,
+                   QObject* parent)
   : QObject(parent),
-    worker_pool_(worker_pool)
+    worker_pool_(worker_pool),
+    index_worker_pool_(index_worker_pool)
 {
   ProjectExplorer::ProjectExplorerPlugin* pe =
      ProjectExplorer::ProjectExplorerPlugin::instance();
@@ -35,22 +40,73 @@ void Projects::ProjectAdded(ProjectExplorer::Project* project) {
 
   WorkerClient::ReplyType* reply =
       worker_pool_->NextHandler()->CreateProject(project_root);
-  NewClosure(reply, SIGNAL(Finished(bool)),
-             this, SLOT(CreateProjectFinished(WorkerClient::ReplyType*,QString)),
-             reply, project_root);
-}
+  connect(reply, SIGNAL(Finished(bool)), reply, SLOT(deleteLater()));
 
-void Projects::CreateProjectFinished(WorkerClient::ReplyType* reply,
-                                     const QString& project_root) {
-  reply->deleteLater();
+  // The index worker needs its own copy of the project to parse the files.
+  // It leaves saving rope's data to the editor worker.  It handles requests in
+  // order, so the rebuild can be sent straight away.
+  WorkerClient* index_worker = index_worker_pool_->NextHandler();
 
-  reply = worker_pool_->NextHandler()->RebuildSymbolIndex(project_root);
+  reply = index_worker->CreateProject(project_root, true);
   connect(reply, SIGNAL(Finished(bool)), reply, SLOT(deleteLater()));
+
+  reply = index_worker->RebuildSymbolIndex(project_root);
+  connect(reply, SIGNAL(PartialResult()), SLOT(RebuildSymbolIndexProgress()));
+  connect(reply, SIGNAL(Finished(bool)), SLOT(RebuildSymbolIndexFinished(bool)));
+
+  QFutureInterface<void>* progress = new QFutureInterface<void>;
+  progress->setProgressRange(0, 1);
+  progress->reportStarted();
+  rebuild_progress_[reply] = progress;
+
+  Core::ICore::instance()->progressManager()->addTask(
+        progress->future(),
+        tr("Indexing %1").arg(project->displayName()),
+        constants::kIndexTaskId);
 }
 
 void Projects::AboutToRemoveProject(ProjectExplorer::Project* project) {
+  const QString project_root = project->projectDirectory();
+
   WorkerClient::ReplyType* reply =
-      worker_pool_->NextHandler()->DestroyProject(project->projectDirectory());
+      worker_pool_->NextHandler()->DestroyProject(project_root);
+  connect(reply, SIGNAL(Finished(bool)), reply, SLOT(deleteLater()));
 
+  reply = index_worker_pool_->NextHandler()->DestroyProject(project_root);
   connect(reply, SIGNAL(Finished(bool)), reply, SLOT(deleteLater()));
 }
+
+void Projects::RebuildSymbolIndexProgress() {
+  WorkerClient::ReplyType* reply =
+      static_cast<WorkerClient::ReplyType*>(sender());
+  QFutureInterface<void>* progress = rebuild_progress_.value(reply);
+
+  // Each response has the counts so far, so the last one wins.
+  foreach (pb::Message* message, reply->TakePartialResults()) {
+    const pb::RebuildSymbolIndexResponse& response =
+        message->rebuild_symbol_index_response();
+
+    if (progress) {
+      progress->setProgressRange(0, response.file_count());
+      progress->setProgressValue(response.indexed_file_count());
+    }
+    MessagePool<pb::Message>::Recycle(message);
+  }
+}
+
+void Projects::RebuildSymbolIndexFinished(bool success) {
+  WorkerClient::ReplyType* reply =
+      static_cast<WorkerClient::ReplyType*>(sender());
+  QFutureInterface<void>* progress = rebuild_progress_.take(reply);
+
+  if (progress) {
+    // A worker that went away has its rebuild resent by its replacement, but
+    // this task stops here.
+    if (!success) {
+      progress->reportCanceled();
+    }
+    progress->reportFinished();
+    delete progress;
+  }
+  reply->deleteLater();
+}
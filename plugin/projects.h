@@ -1,7 +1,9 @@
 #ifndef PYQTC_PROJECTS_H
 #define PYQTC_PROJECTS_H
 
+#include <QFutureInterface>
 #include <QIcon>
+#include <QMap>
 #include <QMultiMap>
 #include <QObject>
 
@@ -23,17 +25,23 @@ class Projects : public QObject {
   Q_OBJECT
 
 public:
-  Projects(WorkerPool<WorkerClient>* worker_pool, QObject* parent = 0);
+  Projects(WorkerPool<WorkerClient>* worker_pool,
+           WorkerPool<WorkerClient>* index_worker_pool,
+           QObject* parent = 0);
 
 private slots:
   void ProjectAdded(ProjectExplorer::Project* project);
   void AboutToRemoveProject(ProjectExplorer::Project* project);
 
-  void CreateProjectFinished(WorkerClient::ReplyType* reply,
-                             const QString& project_root);
+  void RebuildSymbolIndexProgress();
+  void RebuildSymbolIndexFinished(bool success);
 
 private:
   WorkerPool<WorkerClient>* worker_pool_;
+  WorkerPool<WorkerClient>* index_worker_pool_;
+
+  // The progress bar shown for each symbol index rebuild, by its reply.
+  QMap<QObject*, QFutureInterface<void>*> rebuild_progress_;
 };
 
 } // namespace pyqtc
@@ -24,6 +24,8 @@
 
 using namespace pyqtc;
 
+const int PythonFilterBase::kPartialResultPollMsec = 50;
+
 PythonFilterBase::PythonFilterBase(WorkerPool<WorkerClient>* worker_pool,
                                    const PythonIcons* icons)
   : Locator::ILocatorFilter(NULL),
@@ -38,17 +40,45 @@ QList<Locator::FilterEntry> PythonFilterBase::matchesFor(
     QFutureInterface<Locator::FilterEntry>& future, const QString& entry) {
   QScopedPointer<WorkerClient::ReplyType> reply(
         worker_pool_->NextHandler()->Search(entry, file_path_, symbol_type_));
-  reply->WaitForFinished();
+
+  // The results from each project but the last arrive in a partial response.
+  // They're reported to the locator as they arrive, and only the last
+  // project's results are returned.  The reply is still waited for if the
+  // search is canceled, since the handler holds on to it until it finishes.
+  while (!reply->WaitForFinished(kPartialResultPollMsec)) {
+    ReportPartialResults(reply.data(), future);
+  }
+  ReportPartialResults(reply.data(), future);
 
   QList<Locator::FilterEntry> ret;
-  if (!reply->is_successful() || future.isCanceled()) {
-    return ret;
+  if (reply->is_successful() && !future.isCanceled()) {
+    AddResults(reply->message().search_response(), &ret);
   }
+  return ret;
+}
 
-  const pb::SearchResponse* response = &reply->message().search_response();
+void PythonFilterBase::ReportPartialResults(
+    WorkerClient::ReplyType* reply,
+    QFutureInterface<Locator::FilterEntry>& future) {
+  QList<pb::Message*> partial_results = reply->TakePartialResults();
+
+  QList<Locator::FilterEntry> entries;
+  foreach (pb::Message* message, partial_results) {
+    if (!future.isCanceled()) {
+      AddResults(message->search_response(), &entries);
+    }
+    MessagePool<pb::Message>::Recycle(message);
+  }
 
-  for (int i=0 ; i<response->result_size() ; ++i) {
-    const pb::SearchResponse_Result* result = &response->result(i);
+  foreach (const Locator::FilterEntry& entry, entries) {
+    future.reportResult(entry);
+  }
+}
+
+void PythonFilterBase::AddResults(const pb::SearchResponse& response,
+                                  QList<Locator::FilterEntry>* entries) {
+  for (int i=0 ; i<response.result_size() ; ++i) {
+    const pb::SearchResponse_Result* result = &response.result(i);
 
     EntryInternalData internal_data(result->file_path(), result->line_number());
 
@@ -57,10 +87,8 @@ QList<Locator::FilterEntry> PythonFilterBase::matchesFor(
     entry.extraInfo = result->module_name();
     entry.displayIcon = icons_->IconForSearchResult(*result);
 
-    ret << entry;
+    (*entries) << entry;
   }
-
-  return ret;
 }
 
 void PythonFilterBase::accept(Locator::FilterEntry selection) const {
@@ -34,6 +34,9 @@ class PythonIcons;
 
 class PythonFilterBase : public Locator::ILocatorFilter {
 public:
+  // How often matchesFor checks for partial results while it waits.
+  static const int kPartialResultPollMsec;
+
   PythonFilterBase(WorkerPool<WorkerClient>* worker_pool,
                    const PythonIcons* icons);
 
@@ -57,6 +60,15 @@ protected:
   void set_symbol_type(pb::SymbolType type) { symbol_type_ = type; }
   void set_file_path(const QString& file_path) { file_path_ = file_path; }
 
+private:
+  void AddResults(const pb::SearchResponse& response,
+                  QList<Locator::FilterEntry>* entries);
+
+  // Reports the entries in the partial results that have arrived so far, so
+  // the locator can show them before the search finishes.
+  void ReportPartialResults(WorkerClient::ReplyType* reply,
+                            QFutureInterface<Locator::FilterEntry>& future);
+
 private:
   WorkerPool<WorkerClient>* worker_pool_;
   const PythonIcons* icons_;
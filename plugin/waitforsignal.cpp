@@ -18,9 +18,15 @@
 #include "waitforsignal.h"
 
 #include <QEventLoop>
+#include <QTimer>
 
-void WaitForSignal(QObject* sender, const char* signal) {
+void WaitForSignal(QObject* sender, const char* signal, int timeout_msec) {
   QEventLoop loop;
   QObject::connect(sender, signal, &loop, SLOT(quit()));
+
+  if (timeout_msec != -1) {
+    QTimer::singleShot(timeout_msec, &loop, SLOT(quit()));
+  }
+
   loop.exec();
 }
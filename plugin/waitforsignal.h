@@ -20,6 +20,8 @@
 
 class QObject;
 
-void WaitForSignal(QObject* sender, const char* signal);
+// Runs an event loop until sender emits signal, or until timeout_msec
+// milliseconds have passed if timeout_msec is not -1.
+void WaitForSignal(QObject* sender, const char* signal, int timeout_msec = -1);
 
 #endif // WAITFORSIGNAL_H
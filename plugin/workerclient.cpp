@@ -1,103 +1,339 @@
+#include "latencystats.h"
+#include "messagetrace.h"
 #include "workerclient.h"
 
+#include <QtDebug>
+
 using namespace pyqtc;
 
+const int WorkerClient::kRequestTimeoutMsec = 30 * 1000;
+const int WorkerClient::kLongRequestTimeoutMsec = 10 * 60 * 1000;
+const int WorkerClient::kHeartbeatTimeoutMsec = 10 * 1000;
+const int WorkerClient::kCompletionTimeBudgetMsec = 150;
+
+const int WorkerClient::kProtocolVersion = pb::PROTOCOL_VERSION_3;
+const int WorkerClient::kFeatures = pb::FEATURE_COMPRESSION;
+
 
 WorkerClient::WorkerClient(QIODevice* device, QObject* parent)
-    : AbstractMessageHandler<pb::Message>(device, parent)
+    : AbstractMessageHandler<pb::Message>(device, parent),
+      stub_(this),
+      heartbeat_pending_(false),
+      worker_version_(pb::PROTOCOL_VERSION_1),
+      features_(0),
+      trace_(NULL)
 {
 }
 
-WorkerClient::ReplyType* WorkerClient::CreateProject(const QString& project_root) {
-  pb::Message message;
-  pb::CreateProjectRequest* req = message.mutable_create_project_request();
+LatencyStats* WorkerClient::latency_stats() {
+  static LatencyStats sStats;
+  return &sStats;
+}
+
+QString WorkerClient::RequestName(const pb::Message& message) {
+  static const std::string kSuffix = "_request";
 
-  req->set_project_root(project_root);
+  const google::protobuf::Descriptor* descriptor = message.GetDescriptor();
+
+  if (message.has_method()) {
+    const google::protobuf::FieldDescriptor* field =
+        descriptor->FindFieldByNumber(message.method());
+    if (field) {
+      const std::string& name = field->name();
+      return QString::fromAscii(name.data(), name.size() - kSuffix.size());
+    }
+  }
+
+  // Messages from traces recorded before the method was sent.
+  const google::protobuf::Reflection* reflection = message.GetReflection();
+
+  for (int i=0 ; i<descriptor->field_count() ; ++i) {
+    const google::protobuf::FieldDescriptor* field = descriptor->field(i);
+    const std::string& name = field->name();
+
+    if (name.size() > kSuffix.size() &&
+        name.compare(name.size() - kSuffix.size(), kSuffix.size(), kSuffix) == 0 &&
+        reflection->HasField(message, field)) {
+      return QString::fromAscii(name.data(), name.size() - kSuffix.size());
+    }
+  }
 
-  return SendMessageWithReply(&message);
+  return QString();
+}
+
+WorkerClient::ReplyType* WorkerClient::SendRequest(pb::Message* message,
+                                                  int timeout_msec) {
+  message->set_version(kProtocolVersion);
+  ReplyType* reply = NewReply(message, timeout_msec);
+
+  reply->set_request_name(RequestName(*message));
+  reply->mutable_timings()->sent_usec = CurrentTimeUsec();
+
+  if (trace_ && !message->has_hello_request() &&
+      !message->has_heartbeat_request()) {
+    const std::string data = message->SerializeAsString();
+    trace_->Record(QByteArray(data.data(), data.size()));
+  }
+
+  SendMessageAsync(*message);
+
+  return reply;
+}
+
+int WorkerClient::TimeoutForRequest(const pb::Message& message) {
+  if (message.has_create_project_request() ||
+      message.has_rebuild_symbol_index_request()) {
+    return kLongRequestTimeoutMsec;
+  }
+
+  if (message.has_hello_request() || message.has_heartbeat_request()) {
+    return kHeartbeatTimeoutMsec;
+  }
+
+  if (message.has_batch_request()) {
+    const pb::BatchRequest& batch = message.batch_request();
+
+    int timeout_msec = 0;
+    for (int i=0 ; i<batch.request_size() ; ++i) {
+      timeout_msec += TimeoutForRequest(batch.request(i));
+    }
+    return timeout_msec;
+  }
+
+  return kRequestTimeoutMsec;
+}
+
+void WorkerClient::ReplyArrived(const pb::Message& message, ReplyType* reply) {
+  MessageTimings* timings = reply->mutable_timings();
+  timings->worker_started_usec = message.worker_started_usec();
+  timings->worker_finished_usec = message.worker_finished_usec();
+
+  latency_stats()->AddReply(reply->request_name(), *timings);
+
+  // An error response finishes the rebuild too.
+  if (reply->request_name() == "rebuild_symbol_index") {
+    QMutexLocker l(&project_mutex_);
+    pending_rebuilds_.remove(reply->id());
+  }
+
+  if (message.has_hello_response()) {
+    const pb::HelloResponse& response = message.hello_response();
+    worker_version_ = response.version();
+    features_ = response.features() & kFeatures;
+
+    SetCompressionEnabled(features_ & pb::FEATURE_COMPRESSION);
+  }
+
+  if (message.has_heartbeat_response()) {
+    heartbeat_pending_ = false;
+  }
+}
+
+WorkerClient::ReplyType* WorkerClient::Handshake() {
+  pb::HelloRequest req;
+
+  req.set_version(kProtocolVersion);
+  req.set_features(kFeatures);
+
+  return stub_.Hello(&req, kHeartbeatTimeoutMsec);
+}
+
+void WorkerClient::SendHeartbeat() {
+  // Don't queue a heartbeat behind a long request - that request's own
+  // deadline will catch the worker if it hangs.
+  if (heartbeat_pending_ || HasPendingReplies()) {
+    return;
+  }
+
+  pb::HeartbeatRequest req;
+  ReplyType* reply = stub_.Heartbeat(&req, kHeartbeatTimeoutMsec);
+  QObject::connect(reply, SIGNAL(Finished(bool)), reply, SLOT(deleteLater()));
+  heartbeat_pending_ = true;
+}
+
+void WorkerClient::ReplayState(WorkerClient* previous) {
+  QMap<QString, bool> projects;
+  QList<QString> rebuilds;
+  {
+    QMutexLocker l(&previous->project_mutex_);
+    projects = previous->projects_;
+    rebuilds = previous->pending_rebuilds_.values();
+  }
+
+  for (QMap<QString, bool>::const_iterator it = projects.constBegin() ;
+       it != projects.constEnd() ; ++it) {
+    qDebug() << "Recreating project" << it.key() << "in restarted worker";
+    ReplyType* reply = CreateProject(it.key(), it.value());
+    QObject::connect(reply, SIGNAL(Finished(bool)), reply, SLOT(deleteLater()));
+  }
+
+  // Rebuilds that were aborted when the old worker went away.
+  foreach (const QString& project_root, rebuilds) {
+    qDebug() << "Rebuilding symbol index of" << project_root
+             << "in restarted worker";
+    ReplyType* reply = RebuildSymbolIndex(project_root);
+    QObject::connect(reply, SIGNAL(Finished(bool)), reply, SLOT(deleteLater()));
+  }
+}
+
+WorkerClient::ReplyType* WorkerClient::CreateProject(const QString& project_root,
+                                                     bool read_only) {
+  pb::CreateProjectRequest req;
+
+  req.set_project_root(project_root);
+  req.set_read_only(read_only);
+
+  {
+    QMutexLocker l(&project_mutex_);
+    projects_[project_root] = read_only;
+  }
+
+  return stub_.CreateProject(&req, kLongRequestTimeoutMsec);
 }
 
 WorkerClient::ReplyType* WorkerClient::DestroyProject(const QString& project_root) {
-  pb::Message message;
-  pb::DestroyProjectRequest* req = message.mutable_destroy_project_request();
+  pb::DestroyProjectRequest req;
+
+  req.set_project_root(project_root);
 
-  req->set_project_root(project_root);
+  {
+    QMutexLocker l(&project_mutex_);
+    projects_.remove(project_root);
 
-  return SendMessageWithReply(&message);
+    foreach (int id, pending_rebuilds_.keys(project_root)) {
+      pending_rebuilds_.remove(id);
+    }
+  }
+
+  return stub_.DestroyProject(&req, kRequestTimeoutMsec);
 }
 
 WorkerClient::ReplyType* WorkerClient::Completion(const QString& file_path,
                                                   const QString& source_text,
                                                   int cursor_position) {
-  pb::Message message;
-  pb::CompletionRequest* req = message.mutable_completion_request();
+  pb::CompletionRequest req;
 
-  req->mutable_context()->set_file_path(file_path);
-  req->mutable_context()->set_source_text(source_text);
-  req->mutable_context()->set_cursor_position(cursor_position);
+  req.mutable_context()->set_file_path(file_path);
+  req.mutable_context()->set_source_text(source_text);
+  req.mutable_context()->set_cursor_position(cursor_position);
+  req.mutable_context()->set_time_budget_msec(kCompletionTimeBudgetMsec);
 
-  return SendMessageWithReply(&message);
+  return stub_.Completion(&req, kRequestTimeoutMsec);
 }
 
 WorkerClient::ReplyType* WorkerClient::Tooltip(const QString& file_path,
                                                const QString& source_text,
                                                int cursor_position) {
-  pb::Message message;
-  pb::TooltipRequest* req = message.mutable_tooltip_request();
+  pb::TooltipRequest req;
 
-  req->mutable_context()->set_file_path(file_path);
-  req->mutable_context()->set_source_text(source_text);
-  req->mutable_context()->set_cursor_position(cursor_position);
+  req.mutable_context()->set_file_path(file_path);
+  req.mutable_context()->set_source_text(source_text);
+  req.mutable_context()->set_cursor_position(cursor_position);
 
-  return SendMessageWithReply(&message);
+  return stub_.Tooltip(&req, kRequestTimeoutMsec);
 }
 
 WorkerClient::ReplyType* WorkerClient::DefinitionLocation(const QString& file_path,
                                                           const QString& source_text,
                                                           int cursor_position) {
-  pb::Message message;
-  pb::DefinitionLocationRequest* req = message.mutable_definition_location_request();
+  pb::DefinitionLocationRequest req;
 
-  req->mutable_context()->set_file_path(file_path);
-  req->mutable_context()->set_source_text(source_text);
-  req->mutable_context()->set_cursor_position(cursor_position);
+  req.mutable_context()->set_file_path(file_path);
+  req.mutable_context()->set_source_text(source_text);
+  req.mutable_context()->set_cursor_position(cursor_position);
 
-  return SendMessageWithReply(&message);
+  return stub_.DefinitionLocation(&req, kRequestTimeoutMsec);
 }
 
 WorkerClient::ReplyType* WorkerClient::RebuildSymbolIndex(const QString& project_root) {
+  pb::RebuildSymbolIndexRequest req;
   pb::Message message;
-  pb::RebuildSymbolIndexRequest* req = message.mutable_rebuild_symbol_index_request();
 
-  req->set_project_root(project_root);
+  req.set_project_root(project_root);
+
+  // Progress is reported in partial responses.
+  message.set_accept_partial(true);
 
-  return SendMessageWithReply(&message);
+  // Held until the rebuild is recorded, so ReplyArrived can't miss it.
+  QMutexLocker l(&project_mutex_);
+  ReplyType* reply =
+      stub_.RebuildSymbolIndex(&req, kLongRequestTimeoutMsec, &message);
+  pending_rebuilds_[reply->id()] = project_root;
+  return reply;
 }
 
 WorkerClient::ReplyType* WorkerClient::UpdateSymbolIndex(const QString& file_path) {
-  pb::Message message;
-  pb::UpdateSymbolIndexRequest* req = message.mutable_update_symbol_index_request();
+  pb::UpdateSymbolIndexRequest req;
 
-  req->set_file_path(file_path);
+  req.set_file_path(file_path);
 
-  return SendMessageWithReply(&message);
+  return stub_.UpdateSymbolIndex(&req, kRequestTimeoutMsec);
 }
 
 WorkerClient::ReplyType* WorkerClient::Search(const QString& query,
                                               const QString& file_path,
                                               pb::SymbolType type) {
-  pb::Message message;
-  pb::SearchRequest* req = message.mutable_search_request();
+  pb::SearchRequest req;
 
-  req->set_query(query);
+  req.set_query(query);
 
   if (!file_path.isEmpty()) {
-    req->set_file_path(file_path);
+    req.set_file_path(file_path);
   }
 
   if (type != pb::ALL) {
-    req->set_symbol_type(type);
+    req.set_symbol_type(type);
   }
 
-  return SendMessageWithReply(&message);
+  // Each project's results are sent as soon as they're found.
+  pb::Message message;
+  message.set_accept_partial(true);
+
+  return stub_.Search(&req, kRequestTimeoutMsec, &message);
+}
+
+WorkerClient::ReplyType* WorkerClient::MemoryStats(const QString& project_root) {
+  pb::MemoryStatsRequest req;
+
+  if (!project_root.isEmpty()) {
+    req.set_project_root(project_root);
+  }
+
+  return stub_.MemoryStats(&req, kRequestTimeoutMsec);
+}
+
+WorkerClient::ReplyType* WorkerClient::SendBatch(WorkerBatch* batch) {
+  const int timeout_msec = batch->timeout_msec();
+  return stub_.Batch(batch->mutable_request(), timeout_msec);
+}
+
+
+WorkerBatch::WorkerBatch(const QString& file_path,
+                         const QString& source_text,
+                         int cursor_position)
+  : timeout_msec_(0)
+{
+  request_.mutable_context()->set_file_path(file_path);
+  request_.mutable_context()->set_source_text(source_text);
+  request_.mutable_context()->set_cursor_position(cursor_position);
+}
+
+pb::Message* WorkerBatch::AddRequest(pb::Method method, int timeout_msec) {
+  pb::Message* message = request_.add_request();
+  message->set_method(method);
+
+  timeout_msec_ += timeout_msec;
+  return message;
+}
+
+int WorkerBatch::Tooltip() {
+  AddRequest(pb::METHOD_TOOLTIP, WorkerClient::kRequestTimeoutMsec)
+      ->mutable_tooltip_request();
+  return request_.request_size() - 1;
+}
+
+int WorkerBatch::DefinitionLocation() {
+  AddRequest(pb::METHOD_DEFINITION_LOCATION, WorkerClient::kRequestTimeoutMsec)
+      ->mutable_definition_location_request();
+  return request_.request_size() - 1;
 }
@@ -4,15 +4,56 @@
 #include "messagehandler.h"
 #include "rpc.pb.h"
 
+#include <QMap>
+#include <QMutex>
+
 namespace pyqtc {
 
+class LatencyStats;
+class MessageTraceWriter;
+class WorkerBatch;
+
 class WorkerClient : public AbstractMessageHandler<pb::Message> {
 public:
   WorkerClient(QIODevice* device, QObject* parent);
 
-  ReplyType* CreateProject(const QString& project_root);
+  // How long requests can take before the worker is assumed to have hung and
+  // is restarted.  Creating a project and building its symbol index parse
+  // every file in it, so they get much longer.
+  static const int kRequestTimeoutMsec;
+  static const int kLongRequestTimeoutMsec;
+  static const int kHeartbeatTimeoutMsec;
+
+  // How long the worker can spend looking for completions and calltips.
+  // Completion blocks typing, so a partial answer is better than a late one.
+  static const int kCompletionTimeBudgetMsec;
+
+  // The newest protocol version and the features we support.
+  static const int kProtocolVersion;
+  static const int kFeatures;
+
+  // Sends the hello request that agrees on the protocol version and features
+  // to use with the worker.  Called by the WorkerPool when the worker
+  // connects - the handler isn't handed out until the reply has finished.
+  ReplyType* Handshake();
+
+  // The worker's protocol version and the features we both support, once the
+  // handshake has finished.  Workers that don't understand the handshake are
+  // version 1 and support no features.
+  int worker_version() const { return worker_version_; }
+  int features() const { return features_; }
+
+  // Sends CreateProject for each project that was open in the previous
+  // handler's worker, and RebuildSymbolIndex for each rebuild it didn't
+  // finish.  Called by the WorkerPool before a restarted worker's handler is
+  // handed out.
+  void ReplayState(WorkerClient* previous);
+
+  // A read only project's rope data is saved by another worker.
+  ReplyType* CreateProject(const QString& project_root, bool read_only = false);
   ReplyType* DestroyProject(const QString& project_root);
 
+  // The reply's PartialResult signal reports the rebuild's progress.
   ReplyType* RebuildSymbolIndex(const QString& project_root);
   ReplyType* UpdateSymbolIndex(const QString& file_path);
 
@@ -26,9 +67,92 @@ public:
                                 const QString& source_text,
                                 int cursor_position);
 
+  // The results may be split between the reply's partial responses and its
+  // last one.
   ReplyType* Search(const QString& query,
                     const QString& file_path = QString(),
                     pb::SymbolType type = pb::ALL);
+
+  ReplyType* MemoryStats(const QString& project_root = QString());
+
+  // Sends all the requests in the batch in one round trip, leaving the batch
+  // empty.  The reply's batch_response has a response for each request.
+  ReplyType* SendBatch(WorkerBatch* batch);
+
+  // Records the requests sent from now on in the trace, or stops recording if
+  // trace is NULL.  Handshakes and heartbeats aren't recorded.  Must be called
+  // before the handler is shared with other threads.
+  void SetTrace(MessageTraceWriter* trace) { trace_ = trace; }
+
+  // Sends any request message.  Like SendMessageWithReply, but also names the
+  // reply after its request.
+  ReplyType* SendRequest(pb::Message* message,
+                         int timeout_msec = kRequestTimeoutMsec);
+
+  // Returns the timeout the method that sends this kind of request would use.
+  // A batch gets the sum of its requests' timeouts.
+  static int TimeoutForRequest(const pb::Message& message);
+
+  // Sends a heartbeat if no other requests are waiting for the worker, so a
+  // worker that hangs while idle is noticed too.  Called by the WorkerPool's
+  // watchdog in the thread the handler lives in.
+  void SendHeartbeat();
+
+  // Latencies of the requests sent by all the workers.
+  static LatencyStats* latency_stats();
+
+protected:
+  // AbstractMessageHandler
+  void ReplyArrived(const pb::Message& message, ReplyType* reply);
+
+private:
+  pb::WorkerService_MessageStub<WorkerClient> stub_;
+
+  // Only used in the handler's thread.
+  bool heartbeat_pending_;
+
+  // Set in the handler's thread before the handshake's reply finishes.
+  int worker_version_;
+  int features_;
+
+  MessageTraceWriter* trace_;
+
+  // The projects created and not yet destroyed in this worker, and whether
+  // they're read only.  Also the project of each rebuild whose reply hasn't
+  // arrived, by the reply's ID.
+  QMutex project_mutex_;
+  QMap<QString, bool> projects_;
+  QMap<int, QString> pending_rebuilds_;
+
+  // Returns the name of the x_request field that is set in the message,
+  // without the _request suffix.  Uses the message's method if it has one.
+  static QString RequestName(const pb::Message& message);
+};
+
+
+// Requests to send to a worker together with WorkerClient::SendBatch.  The
+// worker handles them in the order they were added.  Requests that need a
+// context use the batch's, so the source is only sent and analysed once.
+class WorkerBatch {
+public:
+  WorkerBatch(const QString& file_path,
+              const QString& source_text,
+              int cursor_position);
+
+  // Each returns the index of the request's response in the BatchResponse.
+  int Tooltip();
+  int DefinitionLocation();
+
+  pb::BatchRequest* mutable_request() { return &request_; }
+
+  // The sum of the requests' timeouts, since they're handled one at a time.
+  int timeout_msec() const { return timeout_msec_; }
+
+private:
+  pb::Message* AddRequest(pb::Method method, int timeout_msec);
+
+  pb::BatchRequest request_;
+  int timeout_msec_;
 };
 
 } // namespace
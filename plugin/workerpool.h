@@ -22,13 +22,20 @@
 #include <QFile>
 #include <QLocalServer>
 #include <QLocalSocket>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QObject>
 #include <QProcess>
 #include <QThread>
+#include <QTimer>
 
 #include "closure.h"
 #include "waitforsignal.h"
 
+namespace pyqtc {
+  class MessageTraceWriter;
+}
+
 
 // Base class containing signals and slots - required because moc doesn't do
 // templated objects.
@@ -43,21 +50,37 @@ signals:
   // worker wasn't found, or couldn't be executed.
   void WorkerFailedToStart();
 
-  // A worker connected and a handler was created for it.  The next call to
+  // A worker connected and finished its handshake.  The next call to
   // NextHandler() won't return NULL.
   void WorkerConnected();
 
 protected slots:
   virtual void DoStart() {}
   virtual void NewConnection() {}
+  virtual void HandshakeFinished(bool) {}
   virtual void ProcessError(QProcess::ProcessError) {}
+  virtual void ZygoteFinished() {}
+  virtual void RestartZygote() {}
+  virtual void CheckWorkers() {}
+  virtual void WorkerDisconnected() {}
 };
 
 
 // Manages a pool of one or more external processes.  A local socket server is
 // started for each process, and the address is passed to the process as
 // argv[1].  The process is expected to connect back to the socket server, and
-// when it does a HandlerType is created for it.
+// when it does a HandlerType is created for it and its Handshake() is called.
+// The handler is handed out once the reply to the handshake has finished.
+// If the worker replaced one that had been handed out, the new handler's
+// ReplayState() is called with the old handler first, so it can tell the new
+// worker whatever the old one had been told.
+// The pool can be moved to a different thread before calling Start(), in which
+// case all the sockets and handlers will live in that thread.  NextHandler()
+// can be called from any thread.
+// A watchdog checks each handler every few seconds.  If HasOverdueReplies()
+// returns true the worker is assumed to have hung, so it is killed, the
+// replies waiting for it are aborted and a new one is started.  Otherwise
+// the handler's SendHeartbeat() is called.
 template <typename HandlerType>
 class WorkerPool : public _WorkerPoolBase {
 public:
@@ -82,30 +105,71 @@ public:
   // is appended to this name when creating each server.
   void SetLocalServerName(const QString& local_server_name);
 
+  // Starts a single zygote process instead, with --zygote added to its
+  // arguments, that forks each worker.  Forked workers start much faster
+  // because the zygote has already done their imports and initialisation.
+  // The zygote is sent "fork <server name>" and "kill <server name>" lines on
+  // its stdin.  If the zygote exits it is restarted along with all the
+  // workers, after a delay that doubles each time it exits before any of its
+  // workers finished a handshake.  If that happens kMaxZygoteRestarts times
+  // in a row the pool starts the workers itself instead.  Only works on Unix.
+  // You must call this before Start().
+  void SetZygoteEnabled(bool enabled);
+
+  // Passes the trace to the SetTrace of each handler the pool creates,
+  // including the ones for restarted workers.  You must call this before
+  // Start().
+  void SetHandlerTrace(pyqtc::MessageTraceWriter* trace);
+
   // Starts all workers.
   void Start();
 
   // Returns a handler in a round-robin fashion.  Will block if no handlers are
-  // available yet.
+  // available yet.  Can be called from any thread.
   HandlerType* NextHandler();
 
 protected:
   void DoStart();
   void NewConnection();
+  void HandshakeFinished(bool success);
   void ProcessError(QProcess::ProcessError error);
+  void ZygoteFinished();
+  void RestartZygote();
+  void CheckWorkers();
+  void WorkerDisconnected();
 
 private:
+  static const int kWatchdogIntervalMsec = 5000;
+  static const int kZygoteRestartDelayMsec = 100;
+  static const int kMaxZygoteRestarts = 5;
+
   struct Worker {
     Worker() : local_server_(NULL), local_socket_(NULL), process_(NULL),
-               handler_(NULL) {}
+               handler_(NULL), handshake_reply_(NULL), ready_(false),
+               previous_handler_(NULL) {}
 
     QLocalServer* local_server_;
     QLocalSocket* local_socket_;
     QProcess* process_;
     HandlerType* handler_;
+
+    // The reply to the handshake until it finishes, then ready_ is set and
+    // NextHandler() can return the handler.
+    QObject* handshake_reply_;
+    bool ready_;
+
+    // The last handler that was handed out, if this worker is a restarted
+    // one that hasn't been handed out yet.
+    HandlerType* previous_handler_;
+
+    // The full name of the local server, used to tell the zygote which
+    // worker to kill.
+    QString server_name_;
   };
 
+  void StartZygote();
   void StartOneWorker(Worker* worker);
+  void RestartHungWorker(Worker* worker);
 
   template <typename T>
   Worker* FindWorker(T Worker::*member, T value) {
@@ -133,6 +197,20 @@ private:
   QString executable_path_;
 
   int worker_count_;
+  QTimer* watchdog_;
+
+  bool zygote_enabled_;
+  QProcess* zygote_;
+
+  // How many times in a row the zygote has exited before any of its workers
+  // finished a handshake.
+  int zygote_failures_;
+
+  pyqtc::MessageTraceWriter* handler_trace_;
+
+  // Protects workers_ and next_worker_, which are changed in the pool's
+  // thread and read by NextHandler in any thread.
+  QMutex mutex_;
   int next_worker_;
   QList<Worker> workers_;
 };
@@ -141,6 +219,11 @@ private:
 template <typename HandlerType>
 WorkerPool<HandlerType>::WorkerPool(QObject* parent)
   : _WorkerPoolBase(parent),
+    watchdog_(NULL),
+    zygote_enabled_(false),
+    zygote_(NULL),
+    zygote_failures_(0),
+    handler_trace_(NULL),
     next_worker_(0)
 {
   worker_count_ = qBound(1, QThread::idealThreadCount() / 2, 2);
@@ -153,11 +236,16 @@ WorkerPool<HandlerType>::WorkerPool(QObject* parent)
 template <typename HandlerType>
 WorkerPool<HandlerType>::~WorkerPool() {
   foreach (const Worker& worker, workers_) {
-    if (worker.local_socket_ && worker.process_) {
+    if (worker.local_socket_) {
       // The worker is connected.  Close his socket and wait for him to exit.
+      // Forked workers would be restarted when their socket closes, so stop
+      // listening first.
       qDebug() << "Closing worker socket";
+      worker.local_socket_->disconnect(this);
       worker.local_socket_->close();
-      worker.process_->waitForFinished(500);
+      if (worker.process_) {
+        worker.process_->waitForFinished(500);
+      }
     }
 
     if (worker.process_ && worker.process_->state() == QProcess::Running) {
@@ -169,6 +257,16 @@ WorkerPool<HandlerType>::~WorkerPool() {
       }
     }
   }
+
+  if (zygote_ && zygote_->state() == QProcess::Running) {
+    // The zygote exits when its stdin is closed.
+    qDebug() << "Closing zygote";
+    zygote_->disconnect(this);
+    zygote_->closeWriteChannel();
+    if (!zygote_->waitForFinished(500)) {
+      zygote_->kill();
+    }
+  }
 }
 
 template <typename HandlerType>
@@ -195,6 +293,18 @@ void WorkerPool<HandlerType>::SetExecutableArguments(const QStringList& args) {
   executable_args_ = args;
 }
 
+template <typename HandlerType>
+void WorkerPool<HandlerType>::SetZygoteEnabled(bool enabled) {
+  Q_ASSERT(workers_.isEmpty());
+  zygote_enabled_ = enabled;
+}
+
+template <typename HandlerType>
+void WorkerPool<HandlerType>::SetHandlerTrace(pyqtc::MessageTraceWriter* trace) {
+  Q_ASSERT(workers_.isEmpty());
+  handler_trace_ = trace;
+}
+
 template <typename HandlerType>
 void WorkerPool<HandlerType>::Start() {
   metaObject()->invokeMethod(this, "DoStart");
@@ -224,13 +334,49 @@ void WorkerPool<HandlerType>::DoStart() {
     }
   }
 
+  if (zygote_enabled_) {
+    StartZygote();
+  }
+
   // Start all the workers
   for (int i=0 ; i<worker_count_ ; ++i) {
     Worker worker;
     StartOneWorker(&worker);
 
+    QMutexLocker l(&mutex_);
     workers_ << worker;
   }
+
+  // The timer is created here so it lives in the pool's thread.
+  watchdog_ = new QTimer(this);
+  watchdog_->setInterval(kWatchdogIntervalMsec);
+  connect(watchdog_, SIGNAL(timeout()), SLOT(CheckWorkers()));
+  watchdog_->start();
+}
+
+template <typename HandlerType>
+void WorkerPool<HandlerType>::StartZygote() {
+  if (zygote_) {
+    zygote_->disconnect(this);
+  }
+  DeleteQObjectPointerLater(&zygote_);
+
+  zygote_ = new QProcess(this);
+  connect(zygote_, SIGNAL(error(QProcess::ProcessError)),
+          SLOT(ProcessError(QProcess::ProcessError)));
+  connect(zygote_, SIGNAL(finished(int,QProcess::ExitStatus)),
+          SLOT(ZygoteFinished()));
+
+  QStringList args = executable_args_;
+  args << "--zygote";
+
+  qDebug() << "Starting zygote" << executable_path_ << args;
+
+  // Wait for it to start so the fork commands can be written straight away.
+  // They are buffered until the zygote is ready to read them.
+  zygote_->setProcessChannelMode(QProcess::ForwardedChannels);
+  zygote_->start(executable_path_, args);
+  zygote_->waitForStarted();
 }
 
 template <typename HandlerType>
@@ -238,14 +384,22 @@ void WorkerPool<HandlerType>::StartOneWorker(Worker* worker) {
   DeleteQObjectPointerLater(&worker->local_server_);
   DeleteQObjectPointerLater(&worker->local_socket_);
   DeleteQObjectPointerLater(&worker->process_);
-  DeleteQObjectPointerLater(&worker->handler_);
 
-  worker->local_server_ = new QLocalServer(this);
-  worker->process_ = new QProcess(this);
+  // Another thread might still be using the old handler, so don't delete it.
+  // It's a child of the pool so it will be deleted with it.  The old handshake
+  // reply is aborted when its socket closes.
+  if (worker->ready_) {
+    worker->previous_handler_ = worker->handler_;
+  }
+  {
+    QMutexLocker l(&mutex_);
+    worker->handler_ = NULL;
+    worker->ready_ = false;
+  }
+  worker->handshake_reply_ = NULL;
 
+  worker->local_server_ = new QLocalServer(this);
   connect(worker->local_server_, SIGNAL(newConnection()), SLOT(NewConnection()));
-  connect(worker->process_, SIGNAL(error(QProcess::ProcessError)),
-          SLOT(ProcessError(QProcess::ProcessError)));
 
   // Create a server, find an unused name and start listening
   forever {
@@ -257,6 +411,18 @@ void WorkerPool<HandlerType>::StartOneWorker(Worker* worker) {
     }
   }
 
+  worker->server_name_ = worker->local_server_->fullServerName();
+
+  if (zygote_enabled_) {
+    qDebug() << "Forking worker for" << worker->server_name_;
+    zygote_->write(QString("fork %1\n").arg(worker->server_name_).toLocal8Bit());
+    return;
+  }
+
+  worker->process_ = new QProcess(this);
+  connect(worker->process_, SIGNAL(error(QProcess::ProcessError)),
+          SLOT(ProcessError(QProcess::ProcessError)));
+
   QStringList args = executable_args_;
   args << worker->local_server_->fullServerName();
 
@@ -283,11 +449,61 @@ void WorkerPool<HandlerType>::NewConnection() {
 
   // We only ever accept one connection per worker, so destroy the server now.
   worker->local_socket_->setParent(this);
+  if (zygote_enabled_) {
+    // Forked workers aren't our child processes, so notice them exiting when
+    // their socket closes.
+    connect(worker->local_socket_, SIGNAL(disconnected()),
+            SLOT(WorkerDisconnected()));
+  }
   worker->local_server_->deleteLater();
   worker->local_server_ = NULL;
 
-  // Create the handler.
-  worker->handler_ = new HandlerType(worker->local_socket_, this);
+  // Create the handler, but don't hand it out until the handshake is done.
+  HandlerType* handler = new HandlerType(worker->local_socket_, this);
+  handler->SetTrace(handler_trace_);
+  {
+    QMutexLocker l(&mutex_);
+    worker->handler_ = handler;
+  }
+
+  worker->handshake_reply_ = handler->Handshake();
+  connect(worker->handshake_reply_, SIGNAL(Finished(bool)),
+          SLOT(HandshakeFinished(bool)));
+}
+
+template <typename HandlerType>
+void WorkerPool<HandlerType>::HandshakeFinished(bool success) {
+  QObject* reply = sender();
+  reply->deleteLater();
+
+  // Find the worker with this reply.  There isn't one if the worker was
+  // restarted since.
+  Worker* worker = FindWorker(&Worker::handshake_reply_, reply);
+  if (!worker)
+    return;
+
+  worker->handshake_reply_ = NULL;
+
+  if (!success) {
+    // The socket closed or the worker hung, and it's being restarted.
+    qDebug() << "Worker handshake failed";
+    return;
+  }
+
+  // The worker handles requests in order, so the replayed ones are done
+  // before any that are sent once the handler is handed out.
+  if (worker->previous_handler_) {
+    worker->handler_->ReplayState(worker->previous_handler_);
+    worker->previous_handler_ = NULL;
+  }
+
+  {
+    QMutexLocker l(&mutex_);
+    worker->ready_ = true;
+  }
+
+  // The zygote is working, so the next time it exits is a new failure.
+  zygote_failures_ = 0;
 
   emit WorkerConnected();
 }
@@ -296,6 +512,18 @@ template <typename HandlerType>
 void WorkerPool<HandlerType>::ProcessError(QProcess::ProcessError error) {
   QProcess* process = qobject_cast<QProcess*>(sender());
 
+  if (process && process == zygote_) {
+    if (error == QProcess::FailedToStart) {
+      qDebug() << "Zygote failed to start";
+      emit WorkerFailedToStart();
+      return;
+    }
+
+    // If the zygote died ZygoteFinished restarts it.
+    qDebug() << "Zygote failed with error" << error;
+    return;
+  }
+
   // Find the worker with this process.
   Worker* worker = FindWorker(&Worker::process_, process);
   if (!worker)
@@ -318,20 +546,135 @@ void WorkerPool<HandlerType>::ProcessError(QProcess::ProcessError error) {
   }
 }
 
+template <typename HandlerType>
+void WorkerPool<HandlerType>::ZygoteFinished() {
+  // The zygote kills its workers when it exits normally, and closing their
+  // sockets makes any that are left exit too.  Stop handing them out until
+  // they're replaced, and don't let WorkerDisconnected replace them first.
+  for (typename QList<Worker>::iterator it = workers_.begin() ;
+       it != workers_.end() ; ++it) {
+    Worker* worker = &(*it);
+    if (worker->local_socket_) {
+      worker->local_socket_->disconnect(this);
+    }
+    if (worker->ready_) {
+      worker->previous_handler_ = worker->handler_;
+    }
+
+    QMutexLocker l(&mutex_);
+    worker->handler_ = NULL;
+    worker->ready_ = false;
+  }
+
+  zygote_failures_ ++;
+  if (zygote_failures_ > kMaxZygoteRestarts) {
+    qDebug() << "Zygote keeps exiting - starting workers without it";
+    zygote_->disconnect(this);
+    DeleteQObjectPointerLater(&zygote_);
+    zygote_enabled_ = false;
+    RestartZygote();
+    return;
+  }
+
+  const int delay_msec = kZygoteRestartDelayMsec << (zygote_failures_ - 1);
+  qDebug() << "Zygote exited - restarting in" << delay_msec << "msec";
+  QTimer::singleShot(delay_msec, this, SLOT(RestartZygote()));
+}
+
+template <typename HandlerType>
+void WorkerPool<HandlerType>::RestartZygote() {
+  // Replace all the workers, with ones started by the pool if the zygote was
+  // given up on.
+  if (zygote_enabled_) {
+    StartZygote();
+  }
+  for (typename QList<Worker>::iterator it = workers_.begin() ;
+       it != workers_.end() ; ++it) {
+    StartOneWorker(&(*it));
+  }
+}
+
+template <typename HandlerType>
+void WorkerPool<HandlerType>::CheckWorkers() {
+  for (typename QList<Worker>::iterator it = workers_.begin() ;
+       it != workers_.end() ; ++it) {
+    Worker* worker = &(*it);
+    if (!worker->handler_)
+      continue;
+
+    if (worker->handler_->HasOverdueReplies()) {
+      qDebug() << "Worker missed a deadline - restarting";
+      RestartHungWorker(worker);
+    } else if (worker->ready_) {
+      worker->handler_->SendHeartbeat();
+    }
+  }
+}
+
+template <typename HandlerType>
+void WorkerPool<HandlerType>::RestartHungWorker(Worker* worker) {
+  HandlerType* handler = worker->handler_;
+  if (worker->ready_) {
+    worker->previous_handler_ = handler;
+  }
+
+  // Stop handing out the handler so new requests go to the other workers.
+  {
+    QMutexLocker l(&mutex_);
+    worker->handler_ = NULL;
+    worker->ready_ = false;
+  }
+
+  // Kill the process without ProcessError or WorkerDisconnected restarting it
+  // as well.
+  worker->local_socket_->disconnect(this);
+  if (worker->process_) {
+    worker->process_->disconnect(this);
+    worker->process_->kill();
+  } else if (zygote_) {
+    zygote_->write(QString("kill %1\n").arg(worker->server_name_).toLocal8Bit());
+  }
+
+  // Abort the replies that were waiting for the worker.
+  worker->local_socket_->abort();
+  metaObject()->invokeMethod(handler, "SocketClosed");
+
+  StartOneWorker(worker);
+}
+
+template <typename HandlerType>
+void WorkerPool<HandlerType>::WorkerDisconnected() {
+  QLocalSocket* socket = qobject_cast<QLocalSocket*>(sender());
+
+  // Find the worker with this socket.
+  Worker* worker = FindWorker(&Worker::local_socket_, socket);
+  if (!worker)
+    return;
+
+  qDebug() << "Forked worker disconnected - restarting";
+  worker->local_socket_->disconnect(this);
+  StartOneWorker(worker);
+}
+
 template <typename HandlerType>
 HandlerType* WorkerPool<HandlerType>::NextHandler() {
   forever {
-    for (int i=0 ; i<workers_.count() ; ++i) {
-      const int worker_index = (next_worker_ + i) % workers_.count();
+    {
+      QMutexLocker l(&mutex_);
+
+      for (int i=0 ; i<workers_.count() ; ++i) {
+        const int worker_index = (next_worker_ + i) % workers_.count();
 
-      if (workers_[worker_index].handler_) {
-        next_worker_ = (worker_index + 1) % workers_.count();
-        return workers_[worker_index].handler_;
+        if (workers_[worker_index].ready_) {
+          next_worker_ = (worker_index + 1) % workers_.count();
+          return workers_[worker_index].handler_;
+        }
       }
     }
 
-    // No workers were connected, wait for one.
-    WaitForSignal(this, SIGNAL(WorkerConnected()));
+    // No workers were connected, wait for one.  The worker might connect in
+    // another thread before we start waiting, so check again every so often.
+    WaitForSignal(this, SIGNAL(WorkerConnected()), 100);
   }
 }
 
@@ -51,7 +51,7 @@ namespace cpp_qt {
 // ===================================================================
 
 FileGenerator::FileGenerator(const FileDescriptor* file,
-                             const string& dllexport_decl)
+                             const Options& options)
   : file_(file),
     message_generators_(
       new scoped_ptr<MessageGenerator>[file->message_type_count()]),
@@ -61,26 +61,26 @@ FileGenerator::FileGenerator(const FileDescriptor* file,
       new scoped_ptr<ServiceGenerator>[file->service_count()]),
     extension_generators_(
       new scoped_ptr<ExtensionGenerator>[file->extension_count()]),
-    dllexport_decl_(dllexport_decl) {
+    dllexport_decl_(options.dllexport_decl) {
 
   for (int i = 0; i < file->message_type_count(); i++) {
     message_generators_[i].reset(
-      new MessageGenerator(file->message_type(i), dllexport_decl));
+      new MessageGenerator(file->message_type(i), options));
   }
 
   for (int i = 0; i < file->enum_type_count(); i++) {
     enum_generators_[i].reset(
-      new EnumGenerator(file->enum_type(i), dllexport_decl));
+      new EnumGenerator(file->enum_type(i), dllexport_decl_));
   }
 
   for (int i = 0; i < file->service_count(); i++) {
     service_generators_[i].reset(
-      new ServiceGenerator(file->service(i), dllexport_decl));
+      new ServiceGenerator(file->service(i), dllexport_decl_));
   }
 
   for (int i = 0; i < file->extension_count(); i++) {
     extension_generators_[i].reset(
-      new ExtensionGenerator(file->extension(i), dllexport_decl));
+      new ExtensionGenerator(file->extension(i), dllexport_decl_));
   }
 
   SplitStringUsing(file_->package(), ".", &package_parts_);
@@ -223,6 +223,11 @@ void FileGenerator::GenerateHeader(io::Printer* printer) {
     printer->Print("\n");
   }
 
+  // Generate message stubs.  These don't need the generic service classes.
+  for (int i = 0; i < file_->service_count(); i++) {
+    service_generators_[i]->GenerateMessageStub(printer);
+  }
+
   // Declare extension identifiers.
   for (int i = 0; i < file_->extension_count(); i++) {
     extension_generators_[i]->GenerateDeclaration(printer);
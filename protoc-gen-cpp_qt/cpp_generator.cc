@@ -61,12 +61,6 @@ bool CppGenerator::Generate(const FileDescriptor* file,
   // -----------------------------------------------------------------
   // parse generator options
 
-  // TODO(kenton):  If we ever have more options, we may want to create a
-  //   class that encapsulates them which we can pass down to all the
-  //   generator classes.  Currently we pass dllexport_decl down to all of
-  //   them via the constructors, but we don't want to have to add another
-  //   constructor parameter for every option.
-
   // If the dllexport_decl option is passed to the compiler, we need to write
   // it in front of every symbol that should be exported if this .proto is
   // compiled into a Windows DLL.  E.g., if the user invokes the protocol
@@ -78,11 +72,20 @@ bool CppGenerator::Generate(const FileDescriptor* file,
   //   }
   // FOO_EXPORT is a macro which should expand to __declspec(dllexport) or
   // __declspec(dllimport) depending on what is being compiled.
-  string dllexport_decl;
+  //
+  // If the lazy_strings option is passed, singular string fields keep the
+  // UTF-8 bytes they were parsed from and only convert them to a QString the
+  // first time they're read.  This makes parsing large messages much cheaper
+  // when most of their strings are never looked at, but the accessors of a
+  // parsed message are no longer safe to call from more than one thread at
+  // once.
+  Options file_options;
 
   for (int i = 0; i < options.size(); i++) {
     if (options[i].first == "dllexport_decl") {
-      dllexport_decl = options[i].second;
+      file_options.dllexport_decl = options[i].second;
+    } else if (options[i].first == "lazy_strings") {
+      file_options.lazy_strings = true;
     } else {
       *error = "Unknown generator option: " + options[i].first;
       return false;
@@ -95,7 +98,7 @@ bool CppGenerator::Generate(const FileDescriptor* file,
   string basename = StripProto(file->name());
   basename.append(".pb");
 
-  FileGenerator file_generator(file, dllexport_decl);
+  FileGenerator file_generator(file, file_options);
 
   // Generate header.
   {
@@ -42,6 +42,75 @@ namespace protobuf {
 namespace compiler {
 namespace cpp_qt {
 
+namespace {
+
+// Converts FooBar to foo_bar.
+string CamelCaseToUnderscores(const string& input) {
+  string result;
+  for (int i = 0; i < input.size(); i++) {
+    if ('A' <= input[i] && input[i] <= 'Z') {
+      if (i > 0) {
+        result += '_';
+      }
+      result += input[i] + ('a' - 'A');
+    } else {
+      result += input[i];
+    }
+  }
+  return result;
+}
+
+// Returns the field in the envelope that wraps the method's request or
+// response, or NULL if there isn't one of the right type.
+const FieldDescriptor* EnvelopeField(const Descriptor* envelope,
+                                     const MethodDescriptor* method,
+                                     const string& suffix,
+                                     const Descriptor* type) {
+  const FieldDescriptor* field = envelope->FindFieldByName(
+      CamelCaseToUnderscores(method->name()) + suffix);
+  if (field == NULL || field->is_repeated() || field->message_type() != type) {
+    return NULL;
+  }
+  return field;
+}
+
+// Returns the message in the service's file that wraps the requests and
+// responses of all its methods, or NULL if there isn't one.
+const Descriptor* FindEnvelope(const ServiceDescriptor* service) {
+  const FileDescriptor* file = service->file();
+
+  for (int i = 0; i < file->message_type_count(); i++) {
+    const Descriptor* envelope = file->message_type(i);
+    bool matches = true;
+
+    for (int j = 0; matches && j < service->method_count(); j++) {
+      const MethodDescriptor* method = service->method(j);
+      matches =
+          EnvelopeField(envelope, method, "_request", method->input_type()) &&
+          EnvelopeField(envelope, method, "_response", method->output_type());
+    }
+
+    if (matches) {
+      return envelope;
+    }
+  }
+  return NULL;
+}
+
+// Returns the enum field named "method" in the envelope that says which
+// request is set, or NULL if there isn't one.  Its values are the numbers of
+// the request fields.
+const FieldDescriptor* MethodField(const Descriptor* envelope) {
+  const FieldDescriptor* field = envelope->FindFieldByName("method");
+  if (field == NULL || field->is_repeated() ||
+      field->cpp_type() != FieldDescriptor::CPPTYPE_ENUM) {
+    return NULL;
+  }
+  return field;
+}
+
+}  // namespace
+
 ServiceGenerator::ServiceGenerator(const ServiceDescriptor* descriptor,
                                    const string& dllexport_decl)
   : descriptor_(descriptor) {
@@ -139,6 +208,77 @@ void ServiceGenerator::GenerateStubDefinition(io::Printer* printer) {
     "\n");
 }
 
+void ServiceGenerator::GenerateMessageStub(io::Printer* printer) {
+  const Descriptor* envelope = FindEnvelope(descriptor_);
+  if (envelope == NULL || descriptor_->method_count() == 0) {
+    return;
+  }
+
+  const FieldDescriptor* method_field = MethodField(envelope);
+
+  map<string, string> vars(vars_);
+  vars["envelope"] = ClassName(envelope, true);
+
+  printer->Print(vars,
+    "// Sends $classname$ requests wrapped in a $envelope$.\n"
+    "// HandlerType must have a SendRequest($envelope$* message,\n"
+    "// int timeout_msec) method that sends the message and returns a\n"
+    "// ReplyType*.  Each method takes the contents of its request, and\n"
+    "// optionally the $envelope$ to send it in with other fields set.\n"
+    "template <typename HandlerType>\n"
+    "class $classname$_MessageStub {\n"
+    " public:\n"
+    "  typedef typename HandlerType::ReplyType ReplyType;\n"
+    "\n"
+    "  explicit $classname$_MessageStub(HandlerType* handler)\n"
+    "    : handler_(handler) {}\n"
+    "\n");
+  printer->Indent();
+
+  for (int i = 0; i < descriptor_->method_count(); i++) {
+    const MethodDescriptor* method = descriptor_->method(i);
+    map<string, string> sub_vars(vars);
+    sub_vars["name"] = method->name();
+    sub_vars["input_type"] = ClassName(method->input_type(), true);
+    const FieldDescriptor* request_field =
+        EnvelopeField(envelope, method, "_request", method->input_type());
+    sub_vars["field"] = FieldName(request_field);
+
+    printer->Print(sub_vars,
+      "ReplyType* $name$($input_type$* request, int timeout_msec) {\n"
+      "  $envelope$ message;\n"
+      "  return $name$(request, timeout_msec, &message);\n"
+      "}\n"
+      "\n"
+      "ReplyType* $name$($input_type$* request, int timeout_msec,\n"
+      "    $envelope$* message) {\n"
+      "  message->mutable_$field$()->Swap(request);\n");
+
+    // Tell the receiver which request is set, so it doesn't have to look.
+    if (method_field != NULL &&
+        method_field->enum_type()->FindValueByNumber(request_field->number())) {
+      sub_vars["method_field"] = FieldName(method_field);
+      sub_vars["method_type"] = ClassName(method_field->enum_type(), true);
+      sub_vars["number"] = SimpleItoa(request_field->number());
+      printer->Print(sub_vars,
+        "  message->set_$method_field$(\n"
+        "      static_cast< $method_type$ >($number$));\n");
+    }
+
+    printer->Print(sub_vars,
+      "  return handler_->SendRequest(message, timeout_msec);\n"
+      "}\n"
+      "\n");
+  }
+
+  printer->Outdent();
+  printer->Print(vars,
+    " private:\n"
+    "  HandlerType* handler_;\n"
+    "};\n"
+    "\n");
+}
+
 void ServiceGenerator::GenerateMethodSignatures(
     VirtualOrNon virtual_or_non, io::Printer* printer) {
   for (int i = 0; i < descriptor_->method_count(); i++) {
@@ -64,6 +64,13 @@ class ServiceGenerator {
   // stub implementation.
   void GenerateDeclarations(io::Printer* printer);
 
+  // Generate $classname$_MessageStub, a template that sends each request
+  // wrapped in a message that has a <method>_request and <method>_response
+  // field for every method of the service.  If the message has a "method"
+  // enum field it's set to the number of the request field.  Generates
+  // nothing if there isn't such a message in the file.
+  void GenerateMessageStub(io::Printer* printer);
+
   // Source file stuff.
 
   // Generate code that initializes the global variable storing the service's
@@ -52,6 +52,89 @@ void SetStringVariables(const FieldDescriptor* descriptor,
   (*variables)["default_variable"] = descriptor->default_value_string().empty()
       ? "QString()"
       : "_default_" + FieldName(descriptor) + "_";
+  (*variables)["utf8"] = "_" + FieldName(descriptor) + "_utf8_";
+  (*variables)["undecoded"] = "_" + FieldName(descriptor) + "_undecoded_";
+}
+
+// Substitutes the variables into text, so it can be used as the value of
+// another variable.  Printer doesn't expand variables inside variables.
+string ExpandVariables(const map<string, string>& variables,
+                       const string& text) {
+  string ret = text;
+  for (map<string, string>::const_iterator it = variables.begin();
+       it != variables.end(); ++it) {
+    ret = StringReplace(ret, "$" + it->first + "$", it->second, true);
+  }
+  return ret;
+}
+
+// Prints code that reads a length-delimited field and then runs $assign$
+// with "data" pointing to its "length" bytes.  The bytes are used straight
+// from the input stream's buffer when they're all in it.
+void PrintReadLengthDelimited(io::Printer* printer,
+                              map<string, string> variables,
+                              const string& assign) {
+  variables["assign"] = ExpandVariables(variables, assign);
+  printer->Print(variables,
+    "::google::protobuf::uint32 length;\n"
+    "DO_(input->ReadVarint32(&length));\n"
+    "DO_(static_cast<int>(length) >= 0);\n"
+    "const void* buffer;\n"
+    "int buffer_size;\n"
+    "if (input->GetDirectBufferPointer(&buffer, &buffer_size) &&\n"
+    "    buffer_size >= static_cast<int>(length)) {\n"
+    "  const char* data = static_cast<const char*>(buffer);\n"
+    "  $assign$;\n"
+    "  DO_(input->Skip(length));\n"
+    "} else {\n"
+    "  QByteArray temp;\n"
+    "  temp.resize(length);\n"
+    "  DO_(input->ReadRaw(temp.data(), length));\n"
+    "  const char* data = temp.constData();\n"
+    "  $assign$;\n"
+    "}\n");
+}
+
+// Prints code that writes the QByteArray $value$ as a length-delimited field,
+// without copying it into a std::string first.
+void PrintWriteLengthDelimited(io::Printer* printer,
+                               map<string, string> variables,
+                               const string& value) {
+  variables["value"] = ExpandVariables(variables, value);
+  printer->Print(variables,
+    "::google::protobuf::internal::WireFormatLite::WriteTag(\n"
+    "  $number$,\n"
+    "  ::google::protobuf::internal::WireFormatLite::WIRETYPE_LENGTH_DELIMITED,\n"
+    "  output);\n"
+    "output->WriteVarint32($value$.size());\n"
+    "output->WriteRaw($value$.constData(), $value$.size());\n");
+}
+
+void PrintWriteLengthDelimitedToArray(io::Printer* printer,
+                                      map<string, string> variables,
+                                      const string& value) {
+  variables["value"] = ExpandVariables(variables, value);
+  printer->Print(variables,
+    "target = ::google::protobuf::internal::WireFormatLite::WriteTagToArray(\n"
+    "  $number$,\n"
+    "  ::google::protobuf::internal::WireFormatLite::WIRETYPE_LENGTH_DELIMITED,\n"
+    "  target);\n"
+    "target = ::google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(\n"
+    "  $value$.size(), target);\n"
+    "target = ::google::protobuf::io::CodedOutputStream::WriteRawToArray(\n"
+    "  $value$.constData(), $value$.size(), target);\n");
+}
+
+// Prints code that adds the size of the QByteArray $value$, without its tag,
+// to total_size.
+void PrintLengthDelimitedSize(io::Printer* printer,
+                              map<string, string> variables,
+                              const string& value) {
+  variables["value"] = ExpandVariables(variables, value);
+  printer->Print(variables,
+    "total_size +=\n"
+    "  ::google::protobuf::io::CodedOutputStream::VarintSize32($value$.size()) +\n"
+    "  $value$.size();\n");
 }
 
 }  // namespace
@@ -59,8 +142,10 @@ void SetStringVariables(const FieldDescriptor* descriptor,
 // ===================================================================
 
 StringFieldGenerator::
-StringFieldGenerator(const FieldDescriptor* descriptor)
-  : descriptor_(descriptor) {
+StringFieldGenerator(const FieldDescriptor* descriptor,
+                     const Options& options)
+  : descriptor_(descriptor),
+    lazy_(options.lazy_strings) {
   SetStringVariables(descriptor, &variables_);
 }
 
@@ -68,7 +153,20 @@ StringFieldGenerator::~StringFieldGenerator() {}
 
 void StringFieldGenerator::
 GeneratePrivateMembers(io::Printer* printer) const {
-  printer->Print(variables_, "QString $name$_;\n");
+  // The field is encoded to UTF-8 once in ByteSize() and the bytes are kept
+  // until it's serialized.
+  if (lazy_) {
+    // $utf8$ holds the field's value instead of $name$_ while $undecoded$ is
+    // set, and the first call to $name$() converts it.
+    printer->Print(variables_,
+      "mutable QString $name$_;\n"
+      "mutable QByteArray $utf8$;\n"
+      "mutable bool $undecoded$;\n");
+  } else {
+    printer->Print(variables_,
+      "QString $name$_;\n"
+      "mutable QByteArray $utf8$;\n");
+  }
   if (!descriptor_->default_value_string().empty()) {
     printer->Print(variables_, "static const char* $default_variable$;\n");
   }
@@ -115,6 +213,33 @@ GenerateAccessorDeclarations(io::Printer* printer) const {
 
 void StringFieldGenerator::
 GenerateInlineAccessorDefinitions(io::Printer* printer) const {
+  if (lazy_) {
+    printer->Print(variables_,
+      "inline const QString& $classname$::$name$() const {\n"
+      "  if ($undecoded$) {\n"
+      "    $name$_ = QString::fromUtf8($utf8$.constData(), $utf8$.size());\n"
+      "    $undecoded$ = false;\n"
+      "  }\n"
+      "  return $name$_;\n"
+      "}\n"
+      "inline void $classname$::set_$name$(const QString& value) {\n"
+      "  set_has_$name$();\n"
+      "  $name$_ = value;\n"
+      "  $undecoded$ = false;\n"
+      "}\n"
+      "inline QString* $classname$::mutable_$name$() {\n"
+      "  set_has_$name$();\n"
+      "  $name$();\n"
+      "  return &$name$_;\n"
+      "}\n"
+      "inline QString* $classname$::release_$name$() {\n"
+      "  clear_has_$name$();\n"
+      "  $name$();\n"
+      "  return &$name$_;\n"
+      "}\n");
+    return;
+  }
+
   printer->Print(variables_,
     "inline const QString& $classname$::$name$() const {\n"
     "  return $name$_;\n"
@@ -150,58 +275,87 @@ GenerateClearingCode(io::Printer* printer) const {
     printer->Print(variables_,
       "$name$_ = $default_variable$;\n");
   }
+  printer->Print(variables_, "$utf8$.clear();\n");
+  if (lazy_) {
+    printer->Print(variables_, "$undecoded$ = false;\n");
+  }
 }
 
 void StringFieldGenerator::
 GenerateMergingCode(io::Printer* printer) const {
-  printer->Print(variables_, "set_$name$(from.$name$());\n");
+  if (lazy_) {
+    // Copy the bytes instead of converting them just to copy the QString.
+    printer->Print(variables_,
+      "if (from.$undecoded$) {\n"
+      "  set_has_$name$();\n"
+      "  $utf8$ = from.$utf8$;\n"
+      "  $undecoded$ = true;\n"
+      "} else {\n"
+      "  set_$name$(from.$name$());\n"
+      "}\n");
+  } else {
+    printer->Print(variables_, "set_$name$(from.$name$());\n");
+  }
 }
 
 void StringFieldGenerator::
 GenerateSwappingCode(io::Printer* printer) const {
   printer->Print(variables_, "std::swap($name$_, other->$name$_);\n");
+  if (lazy_) {
+    printer->Print(variables_,
+      "std::swap($utf8$, other->$utf8$);\n"
+      "std::swap($undecoded$, other->$undecoded$);\n");
+  }
 }
 
 void StringFieldGenerator::
 GenerateConstructorCode(io::Printer* printer) const {
   printer->Print(variables_,
     "$name$_ = $default_variable$;\n");
+  if (lazy_) {
+    printer->Print(variables_, "$undecoded$ = false;\n");
+  }
 }
 
 void StringFieldGenerator::
 GenerateMergeFromCodedStream(io::Printer* printer) const {
-  printer->Print(variables_,
-    "std::string temp;\n"
-    "DO_(::google::protobuf::internal::WireFormatLite::Read$declared_type$(\n"
-    "      input, &temp));\n"
-    "*(this->mutable_$name$()) = QString::fromUtf8(temp.data(), temp.size());\n"
-  );
+  if (lazy_) {
+    PrintReadLengthDelimited(printer, variables_,
+      "$utf8$ = QByteArray(data, length)");
+    printer->Print(variables_,
+      "set_has_$name$();\n"
+      "$undecoded$ = true;\n");
+  } else {
+    PrintReadLengthDelimited(printer, variables_,
+      "*(this->mutable_$name$()) = QString::fromUtf8(data, length)");
+  }
 }
 
 void StringFieldGenerator::
 GenerateSerializeWithCachedSizes(io::Printer* printer) const {
-  printer->Print(variables_,
-    "QByteArray temp(this->$name$().toUtf8());\n"
-    "::google::protobuf::internal::WireFormatLite::Write$declared_type$(\n"
-    "  $number$, std::string(temp.constData(), temp.size()), output);\n");
+  PrintWriteLengthDelimited(printer, variables_, "$utf8$");
 }
 
 void StringFieldGenerator::
 GenerateSerializeWithCachedSizesToArray(io::Printer* printer) const {
-  printer->Print(variables_,
-    "QByteArray temp(this->$name$().toUtf8());\n"
-    "target =\n"
-    "  ::google::protobuf::internal::WireFormatLite::Write$declared_type$ToArray(\n"
-    "    $number$, std::string(temp.constData(), temp.size()), target);\n");
+  PrintWriteLengthDelimitedToArray(printer, variables_, "$utf8$");
 }
 
 void StringFieldGenerator::
 GenerateByteSize(io::Printer* printer) const {
-  printer->Print(variables_,
-    "QByteArray temp(this->$name$().toUtf8());\n"
-    "total_size += $tag_size$ +\n"
-    "  ::google::protobuf::internal::WireFormatLite::$declared_type$Size(\n"
-    "    std::string(temp.constData(), temp.size()));\n");
+  if (lazy_) {
+    // Fields that were never decoded still have their bytes.
+    printer->Print(variables_,
+      "if (!$undecoded$) {\n"
+      "  $utf8$ = this->$name$().toUtf8();\n"
+      "}\n"
+      "total_size += $tag_size$;\n");
+  } else {
+    printer->Print(variables_,
+      "$utf8$ = this->$name$().toUtf8();\n"
+      "total_size += $tag_size$;\n");
+  }
+  PrintLengthDelimitedSize(printer, variables_, "$utf8$");
 }
 
 // ===================================================================
@@ -216,8 +370,10 @@ RepeatedStringFieldGenerator::~RepeatedStringFieldGenerator() {}
 
 void RepeatedStringFieldGenerator::
 GeneratePrivateMembers(io::Printer* printer) const {
+  // See StringFieldGenerator::GeneratePrivateMembers().
   printer->Print(variables_,
-    "QStringList $name$_;\n");
+    "QStringList $name$_;\n"
+    "mutable QList<QByteArray> $utf8$;\n");
 }
 
 void RepeatedStringFieldGenerator::
@@ -281,7 +437,9 @@ GenerateInlineAccessorDefinitions(io::Printer* printer) const {
 
 void RepeatedStringFieldGenerator::
 GenerateClearingCode(io::Printer* printer) const {
-  printer->Print(variables_, "$name$_.clear();\n");
+  printer->Print(variables_,
+    "$name$_.clear();\n"
+    "$utf8$.clear();\n");
 }
 
 void RepeatedStringFieldGenerator::
@@ -301,45 +459,41 @@ GenerateConstructorCode(io::Printer* printer) const {
 
 void RepeatedStringFieldGenerator::
 GenerateMergeFromCodedStream(io::Printer* printer) const {
-  printer->Print(variables_,
-    "std::string temp;\n"
-    "DO_(::google::protobuf::internal::WireFormatLite::Read$declared_type$(\n"
-    "      input, &temp));\n"
-    "this->$name$_.append(QString::fromUtf8(temp.data(), temp.size()));\n"
-  );
+  PrintReadLengthDelimited(printer, variables_,
+    "this->$name$_.append(QString::fromUtf8(data, length))");
 }
 
 void RepeatedStringFieldGenerator::
 GenerateSerializeWithCachedSizes(io::Printer* printer) const {
   printer->Print(variables_,
-    "for (int i = 0; i < this->$name$_size(); i++) {\n");
-  printer->Print(variables_,
-    "  QByteArray temp(this->$name$(i).toUtf8());\n"
-    "  ::google::protobuf::internal::WireFormatLite::Write$declared_type$(\n"
-    "    $number$, std::string(temp.constData(), temp.size()), output);\n"
-    "}\n");
+    "for (int i = 0; i < $utf8$.size(); i++) {\n");
+  printer->Indent();
+  PrintWriteLengthDelimited(printer, variables_, "$utf8$.at(i)");
+  printer->Outdent();
+  printer->Print("}\n");
 }
 
 void RepeatedStringFieldGenerator::
 GenerateSerializeWithCachedSizesToArray(io::Printer* printer) const {
   printer->Print(variables_,
-    "for (int i = 0; i < this->$name$_size(); i++) {\n");
-  printer->Print(variables_,
-    "  QByteArray temp(this->$name$(i).toUtf8());\n"
-    "  target = ::google::protobuf::internal::WireFormatLite::\n"
-    "    Write$declared_type$ToArray($number$, std::string(temp.constData(), temp.size()), target);\n"
-    "}\n");
+    "for (int i = 0; i < $utf8$.size(); i++) {\n");
+  printer->Indent();
+  PrintWriteLengthDelimitedToArray(printer, variables_, "$utf8$.at(i)");
+  printer->Outdent();
+  printer->Print("}\n");
 }
 
 void RepeatedStringFieldGenerator::
 GenerateByteSize(io::Printer* printer) const {
   printer->Print(variables_,
     "total_size += $tag_size$ * this->$name$_size();\n"
+    "$utf8$.clear();\n"
     "for (int i = 0; i < this->$name$_size(); i++) {\n"
-    "  QByteArray temp(this->$name$(i).toUtf8());\n"
-    "  total_size += ::google::protobuf::internal::WireFormatLite::$declared_type$Size(\n"
-    "    std::string(temp.constData(), temp.size()));\n"
-    "}\n");
+    "  $utf8$.append(this->$name$(i).toUtf8());\n");
+  printer->Indent();
+  PrintLengthDelimitedSize(printer, variables_, "$utf8$.last()");
+  printer->Outdent();
+  printer->Print("}\n");
 }
 
 // ===================================================================
@@ -456,35 +610,25 @@ GenerateConstructorCode(io::Printer* printer) const {
 
 void BytesFieldGenerator::
 GenerateMergeFromCodedStream(io::Printer* printer) const {
-  printer->Print(variables_,
-    "std::string temp;\n"
-    "DO_(::google::protobuf::internal::WireFormatLite::Read$declared_type$(\n"
-    "      input, &temp));\n"
-    "*(this->mutable_$name$()) = QByteArray(temp.data(), temp.size());\n"
-  );
+  PrintReadLengthDelimited(printer, variables_,
+    "*(this->mutable_$name$()) = QByteArray(data, length)");
 }
 
 void BytesFieldGenerator::
 GenerateSerializeWithCachedSizes(io::Printer* printer) const {
-  printer->Print(variables_,
-    "::google::protobuf::internal::WireFormatLite::Write$declared_type$(\n"
-    "  $number$, std::string(this->$name$().constData(), this->$name$().size()), output);\n");
+  PrintWriteLengthDelimited(printer, variables_, "this->$name$()");
 }
 
 void BytesFieldGenerator::
 GenerateSerializeWithCachedSizesToArray(io::Printer* printer) const {
-  printer->Print(variables_,
-    "target =\n"
-    "  ::google::protobuf::internal::WireFormatLite::Write$declared_type$ToArray(\n"
-    "    $number$, std::string(this->$name$().constData(), this->$name$().size()), target);\n");
+  PrintWriteLengthDelimitedToArray(printer, variables_, "this->$name$()");
 }
 
 void BytesFieldGenerator::
 GenerateByteSize(io::Printer* printer) const {
   printer->Print(variables_,
-    "total_size += $tag_size$ +\n"
-    "  ::google::protobuf::internal::WireFormatLite::$declared_type$Size(\n"
-    "    std::string(this->$name$().constData(), this->$name$().size()));\n");
+    "total_size += $tag_size$;\n");
+  PrintLengthDelimitedSize(printer, variables_, "this->$name$()");
 }
 
 // ===================================================================
@@ -584,41 +728,39 @@ GenerateConstructorCode(io::Printer* printer) const {
 
 void RepeatedBytesFieldGenerator::
 GenerateMergeFromCodedStream(io::Printer* printer) const {
-  printer->Print(variables_,
-    "DO_(::google::protobuf::internal::WireFormatLite::Read$declared_type$(\n"
-    "      input, &temp));\n"
-    "this->$name$_.append(QByteArray(temp.data(), temp.size()));\n"
-  );
+  PrintReadLengthDelimited(printer, variables_,
+    "this->$name$_.append(QByteArray(data, length))");
 }
 
 void RepeatedBytesFieldGenerator::
 GenerateSerializeWithCachedSizes(io::Printer* printer) const {
   printer->Print(variables_,
     "for (int i = 0; i < this->$name$_size(); i++) {\n");
-  printer->Print(variables_,
-    "  ::google::protobuf::internal::WireFormatLite::Write$declared_type$(\n"
-    "    $number$, std::string(this->$name$(i).constData(), this->$name$(i).size()), output);\n"
-    "}\n");
+  printer->Indent();
+  PrintWriteLengthDelimited(printer, variables_, "this->$name$(i)");
+  printer->Outdent();
+  printer->Print("}\n");
 }
 
 void RepeatedBytesFieldGenerator::
 GenerateSerializeWithCachedSizesToArray(io::Printer* printer) const {
   printer->Print(variables_,
     "for (int i = 0; i < this->$name$_size(); i++) {\n");
-  printer->Print(variables_,
-    "  target = ::google::protobuf::internal::WireFormatLite::\n"
-    "    Write$declared_type$ToArray($number$, std::string(this->$name$(i).constData(), this->$name$(i).size()), target);\n"
-    "}\n");
+  printer->Indent();
+  PrintWriteLengthDelimitedToArray(printer, variables_, "this->$name$(i)");
+  printer->Outdent();
+  printer->Print("}\n");
 }
 
 void RepeatedBytesFieldGenerator::
 GenerateByteSize(io::Printer* printer) const {
   printer->Print(variables_,
     "total_size += $tag_size$ * this->$name$_size();\n"
-    "for (int i = 0; i < this->$name$_size(); i++) {\n"
-    "  total_size += ::google::protobuf::internal::WireFormatLite::$declared_type$Size(\n"
-    "    std::string(this->$name$(i).constData(), this->$name$(i).size()));\n"
-    "}\n");
+    "for (int i = 0; i < this->$name$_size(); i++) {\n");
+  printer->Indent();
+  PrintLengthDelimitedSize(printer, variables_, "this->$name$(i)");
+  printer->Outdent();
+  printer->Print("}\n");
 }
 
 }  // namespace cpp_qt
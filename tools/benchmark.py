@@ -0,0 +1,465 @@
+"""
+Benchmarks the worker against generated Python projects of different sizes.
+
+A worker is started from worker.zip for each project and requests are sent to
+it over its socket, just like the plugin does.  The latency of each kind of
+request and the worker's memory usage are written out as JSON, along with how
+much compressing the requests and responses would save and what it costs, and
+how long building a large response takes with protobuf messages and by hand.
+"""
+
+import argparse
+import json
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+import zlib
+
+DEFAULT_SIZES       = "100,1000,10000"
+MODULES_PER_PACKAGE = 20
+CLASSES_PER_MODULE  = 3
+SAMPLE_FILES        = 10
+
+ENCODING_RESULTS    = 1000
+ENCODING_ITERATIONS = 20
+
+MODULE_TEMPLATE = """\
+\"\"\"
+Generated module %(index)d.
+\"\"\"
+
+%(imports)s
+
+CONSTANT_%(index)d = %(index)d
+
+
+class Class%(index)d_0(%(base)s):
+  \"\"\"
+  The first class in module %(index)d.
+  \"\"\"
+
+  def method_%(index)d(self, argument):
+    \"\"\"
+    Returns the argument.
+    \"\"\"
+    return argument
+
+%(classes)s
+
+def function_%(index)d(first, second=None):
+  \"\"\"
+  Does nothing with its arguments.
+  \"\"\"
+  instance = Class%(index)d_0()
+  value = instance.method_%(index)d(first)
+  return value
+"""
+
+CLASS_TEMPLATE = """\
+class Class%(index)d_%(number)d(Class%(index)d_%(previous)d):
+  def method_%(index)d_%(number)d(self):
+    return CONSTANT_%(index)d
+
+"""
+
+
+def ModulePath(index):
+  """
+  Returns the path of the module with this index, relative to the project.
+  """
+
+  return os.path.join("package%d" % (index // MODULES_PER_PACKAGE),
+                      "module%d.py" % index)
+
+
+def ModuleSource(index):
+  """
+  Returns the source of a module.  Modules star-import the previous module in
+  their package and subclass its first class, so the class hierarchies get as
+  deep as the packages are long.
+  """
+
+  if index % MODULES_PER_PACKAGE == 0:
+    imports = ""
+    base    = "object"
+  else:
+    imports = "from module%d import *" % (index - 1)
+    base    = "Class%d_0" % (index - 1)
+
+  classes = "".join(
+    CLASS_TEMPLATE % {"index": index, "number": number, "previous": number - 1}
+    for number in range(1, CLASSES_PER_MODULE))
+
+  return MODULE_TEMPLATE % {
+    "index":   index,
+    "imports": imports,
+    "base":    base,
+    "classes": classes,
+  }
+
+
+def GenerateProject(root, module_count):
+  """
+  Writes module_count modules to the directory.
+  """
+
+  for index in range(module_count):
+    path = os.path.join(root, ModulePath(index))
+    directory = os.path.dirname(path)
+
+    if not os.path.exists(directory):
+      os.makedirs(directory)
+      open(os.path.join(directory, "__init__.py"), "w").close()
+
+    with open(path, "w") as handle:
+      handle.write(ModuleSource(index))
+
+
+def Percentile(sorted_values, percent):
+  """
+  Returns the percentile of the sorted values using the nearest-rank method.
+  """
+
+  if not sorted_values:
+    return 0
+  rank = (percent * len(sorted_values) + 99) // 100
+  return sorted_values[max(0, min(rank - 1, len(sorted_values) - 1))]
+
+
+def ProcessMemory(pid):
+  """
+  Returns the current and peak resident set size of the process in KB, or
+  None on systems without /proc.
+  """
+
+  try:
+    with open("/proc/%d/status" % pid) as handle:
+      fields = dict(line.split(":", 1) for line in handle if ":" in line)
+  except IOError:
+    return None
+
+  def Kb(name):
+    return int(fields[name].split()[0]) if name in fields else None
+
+  return {"rss_kb": Kb("VmRSS"), "peak_rss_kb": Kb("VmHWM")}
+
+
+class Worker(object):
+  """
+  A worker process connected to a socket.
+  """
+
+  def __init__(self, python, worker_zip, verbose, compress):
+    import messagehandler
+    import rpc_pb2
+
+    self.rpc_pb2 = rpc_pb2
+    self.handler = messagehandler.MessageHandler(rpc_pb2.Message)
+    self.next_id = 1
+
+    self.directory = tempfile.mkdtemp(prefix="pyqtc-benchmark-")
+    socket_path = os.path.join(self.directory, "socket")
+
+    server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    server.bind(socket_path)
+    server.listen(1)
+
+    # The worker prints every request and response to stderr.
+    stderr = None if verbose else open(os.devnull, "w")
+
+    # The worker connects once it has imported everything, so this is how
+    # long it takes to start.
+    start = time.time()
+    self.process = subprocess.Popen([python, worker_zip, socket_path],
+                                    stderr=stderr)
+
+    self.sock, _ = server.accept()
+    self.startup_seconds = time.time() - start
+    server.close()
+    self.handle = self.sock.makefile()
+
+    # Agree on the features to use, like the plugin does.
+    features = rpc_pb2.FEATURE_COMPRESSION if compress else 0
+    _, _, response = self.Call("hello_request",
+                               version=rpc_pb2.PROTOCOL_VERSION_3,
+                               features=features)
+    self.handler.compress = bool(response.hello_response.features & features &
+                                 rpc_pb2.FEATURE_COMPRESSION)
+
+  def Close(self):
+    self.sock.close()
+    self.process.wait()
+    shutil.rmtree(self.directory)
+
+  def Memory(self):
+    return ProcessMemory(self.process.pid)
+
+  def Call(self, field_name, **kwargs):
+    """
+    Sends a request and waits for its response.  Returns a (seconds, request,
+    response) tuple.
+    """
+
+    request = self.rpc_pb2.Message()
+    request.id = self.next_id
+    request.version = self.rpc_pb2.PROTOCOL_VERSION_3
+    request.method = request.DESCRIPTOR.fields_by_name[field_name].number
+    self.next_id += 1
+
+    request_pb = getattr(request, field_name)
+    request_pb.SetInParent()
+    for name, value in kwargs.items():
+      if name == "context":
+        request_pb.context.file_path       = value[0]
+        request_pb.context.source_text     = value[1]
+        request_pb.context.cursor_position = value[2]
+      else:
+        setattr(request_pb, name, value)
+
+    start = time.time()
+    self.handler.WriteMessage(self.handle, request)
+    response = self.handler.ReadMessage(self.handle)
+    return (time.time() - start, request, response)
+
+
+class Results(object):
+  """
+  Collects the latencies of each kind of request.
+  """
+
+  def __init__(self, compression_threshold, compression_level):
+    self.compression_threshold = compression_threshold
+    self.compression_level = compression_level
+
+    self.latencies = {}
+    self.errors = {}
+    self.frames = {}
+
+  def Add(self, name, result):
+    seconds, request, response = result
+    self.latencies.setdefault(name, []).append(seconds * 1000)
+    if response.HasField("error_response"):
+      self.errors[name] = self.errors.get(name, 0) + 1
+
+    for message in (request, response):
+      self.AddFrame(name, message.SerializeToString())
+
+  def AddFrame(self, name, data):
+    """
+    Measures how long compressing and decompressing the data takes and how
+    much smaller it gets, if it's large enough to be compressed.
+    """
+
+    stats = self.frames.setdefault(name, {
+      "bytes":            0,
+      "compressed_bytes": 0,
+      "compress_ms":      0.0,
+      "decompress_ms":    0.0,
+    })
+
+    stats["bytes"] += len(data)
+    if len(data) <= self.compression_threshold:
+      stats["compressed_bytes"] += len(data)
+      return
+
+    start = time.time()
+    compressed = zlib.compress(data, self.compression_level)
+    middle = time.time()
+    zlib.decompress(compressed)
+    end = time.time()
+
+    stats["compressed_bytes"] += len(compressed)
+    stats["compress_ms"]      += (middle - start) * 1000
+    stats["decompress_ms"]    += (end - middle) * 1000
+
+  def ToDict(self):
+    ret = {}
+    for name, values in self.latencies.items():
+      values = sorted(values)
+      ret[name] = {
+        "count":  len(values),
+        "errors": self.errors.get(name, 0),
+        "p50_ms": Percentile(values, 50),
+        "p95_ms": Percentile(values, 95),
+        "p99_ms": Percentile(values, 99),
+        "max_ms": values[-1],
+        "frames": self.frames[name],
+      }
+    return ret
+
+
+def BenchmarkProject(args, module_count):
+  """
+  Generates a project with module_count modules, starts a worker for it and
+  sends each kind of request a few times.
+  """
+
+  root = tempfile.mkdtemp(prefix="pyqtc-project-")
+  worker = None
+
+  try:
+    start = time.time()
+    GenerateProject(root, module_count)
+    generate_seconds = time.time() - start
+
+    worker = Worker(args.python, args.worker_zip, args.verbose, args.compress)
+    results = Results(worker.handler.COMPRESSION_THRESHOLD,
+                      worker.handler.COMPRESSION_LEVEL)
+
+    results.Add("create_project",
+                worker.Call("create_project_request", project_root=root))
+    results.Add("rebuild_symbol_index",
+                worker.Call("rebuild_symbol_index_request", project_root=root))
+
+    # Use the last module in evenly spaced packages, since they have the
+    # deepest class hierarchies.
+    package_count = (module_count + MODULES_PER_PACKAGE - 1) // MODULES_PER_PACKAGE
+    step = max(1, package_count // SAMPLE_FILES)
+    samples = [min(module_count, (package + 1) * MODULES_PER_PACKAGE) - 1
+               for package in range(0, package_count, step)][:SAMPLE_FILES]
+
+    for _ in range(args.iterations):
+      for index in samples:
+        path   = os.path.join(root, ModulePath(index))
+        source = ModuleSource(index)
+
+        # Complete the attributes of an instance at the end of the function.
+        completion_source = source + "  instance."
+        completion_offset = len(completion_source)
+        symbol_offset     = source.rindex("method_%d(" % index) + 1
+
+        results.Add("completion", worker.Call("completion_request",
+            context=(path, completion_source, completion_offset)))
+        results.Add("tooltip", worker.Call("tooltip_request",
+            context=(path, source, symbol_offset)))
+        results.Add("definition_location",
+            worker.Call("definition_location_request",
+                        context=(path, source, symbol_offset)))
+        results.Add("update_symbol_index",
+            worker.Call("update_symbol_index_request", file_path=path))
+        results.Add("search",
+            worker.Call("search_request", query="Class%d" % index))
+
+    results.Add("memory_stats",
+                worker.Call("memory_stats_request", project_root=root))
+
+    return {
+      "modules":          module_count,
+      "generate_seconds": generate_seconds,
+      "startup_seconds":  worker.startup_seconds,
+      "memory":           worker.Memory(),
+      "requests":         results.ToDict(),
+    }
+  finally:
+    if worker is not None:
+      worker.Close()
+    shutil.rmtree(root)
+
+
+def BenchmarkEncoding():
+  """
+  Times building and serialising a search response with ENCODING_RESULTS
+  results out of protobuf messages and by hand, with whichever protobuf
+  implementation is being used.
+  """
+
+  import protoencoding
+  import rpc_pb2
+
+  results = [("package.module%d" % index,
+              "/project/package/module%d.py" % index,
+              index,
+              "Class%d" % index,
+              rpc_pb2.CLASS)
+             for index in range(ENCODING_RESULTS)]
+
+  def Messages():
+    message = rpc_pb2.Message()
+    message.id = 1
+    for module_name, file_path, line_number, symbol_name, symbol_type in results:
+      result_pb = message.search_response.result.add()
+      result_pb.module_name = module_name
+      result_pb.file_path   = file_path
+      result_pb.line_number = line_number
+      result_pb.symbol_name = symbol_name
+      result_pb.symbol_type = symbol_type
+    return message.SerializeToString()
+
+  def ByHand():
+    message = rpc_pb2.Message()
+    message.id = 1
+    number = message.DESCRIPTOR.fields_by_name["search_response"].number
+    return message.SerializeToString() + protoencoding.EncodeLengthDelimited(
+        number, protoencoding.EncodeSearchResponse(results))
+
+  if rpc_pb2.Message.FromString(Messages()) != \
+     rpc_pb2.Message.FromString(ByHand()):
+    raise AssertionError("The hand encoded search response is different")
+
+  def Time(function):
+    start = time.time()
+    for _ in range(ENCODING_ITERATIONS):
+      function()
+    return (time.time() - start) * 1000 / ENCODING_ITERATIONS
+
+  return {
+    "implementation": "python" if protoencoding.IsPurePython() else "cpp",
+    "results":        ENCODING_RESULTS,
+    "messages_ms":    Time(Messages),
+    "by_hand_ms":     Time(ByHand),
+  }
+
+
+def Main():
+  parser = argparse.ArgumentParser(description=__doc__)
+  parser.add_argument("worker_zip", help="path to the worker.zip to benchmark")
+  parser.add_argument("--sizes", default=DEFAULT_SIZES,
+      help="comma separated numbers of modules in each generated project")
+  parser.add_argument("--iterations", type=int, default=3,
+      help="how many times to send each request to each sample file")
+  parser.add_argument("--python", default=sys.executable,
+      help="the Python interpreter to run the worker with")
+  parser.add_argument("--output", help="write the results to this file "
+                                       "instead of stdout")
+  parser.add_argument("--verbose", action="store_true",
+      help="show the worker's debugging output")
+  parser.add_argument("--compress", action="store_true",
+      help="compress large requests and responses on the socket")
+  parser.add_argument("--protobuf-implementation", default="auto",
+      choices=["auto", "python", "cpp"],
+      help="the protobuf implementation to use here and in the worker")
+  args = parser.parse_args()
+
+  args.worker_zip = os.path.abspath(args.worker_zip)
+
+  # The worker's modules are imported from the zip so the requests are
+  # encoded with exactly the same protobuf definitions.
+  sys.path.insert(0, args.worker_zip)
+  import protoencoding
+
+  # The worker inherits the choice through the environment.
+  if args.protobuf_implementation == "auto":
+    protoencoding.UseFastestImplementation()
+  else:
+    os.environ[protoencoding.IMPLEMENTATION_VARIABLE] = \
+        args.protobuf_implementation
+
+  results = {"projects": [], "encoding": BenchmarkEncoding()}
+  for size in args.sizes.split(","):
+    print >> sys.stderr, "Benchmarking a project with %s modules" % size
+    results["projects"].append(BenchmarkProject(args, int(size)))
+
+  output = json.dumps(results, indent=2, sort_keys=True)
+  if args.output:
+    with open(args.output, "w") as handle:
+      handle.write(output + "\n")
+  else:
+    print output
+
+
+if __name__ == "__main__":
+  Main()
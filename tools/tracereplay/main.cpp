@@ -0,0 +1,159 @@
+// Replays a trace recorded by running Qt Creator with $PYQTC_TRACE_FILE set
+// against a worker, and reports the worker's throughput and the latency of
+// each kind of request.  The projects in the trace must exist at the same
+// paths as when it was recorded.
+//
+// By default each request is sent as soon as the previous reply arrives.  With
+// --realtime requests are sent at the times they were recorded instead, so
+// they queue up in the worker like they did in the editor.
+
+#include "latencystats.h"
+#include "messagetrace.h"
+#include "workerclient.h"
+#include "workerpool.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QThread>
+
+#include <cstdio>
+
+using namespace pyqtc;
+
+namespace {
+
+// QThread::msleep is protected in Qt 4.
+class Sleeper : public QThread {
+public:
+  static void Msleep(unsigned long msec) { msleep(msec); }
+};
+
+void PrintUsage(const QString& argv0) {
+  fprintf(stderr, "Usage: %s [--realtime] [--json] trace-file worker.zip\n",
+          argv0.toLocal8Bit().constData());
+}
+
+} // namespace
+
+
+int main(int argc, char** argv) {
+  QCoreApplication app(argc, argv);
+
+  bool realtime = false;
+  bool json = false;
+  QStringList filenames;
+
+  QStringList args = app.arguments();
+  const QString argv0 = args.takeFirst();
+
+  foreach (const QString& arg, args) {
+    if (arg == "--realtime") {
+      realtime = true;
+    } else if (arg == "--json") {
+      json = true;
+    } else if (arg.startsWith("-")) {
+      PrintUsage(argv0);
+      return 1;
+    } else {
+      filenames << arg;
+    }
+  }
+
+  if (filenames.count() != 2) {
+    PrintUsage(argv0);
+    return 1;
+  }
+
+  MessageTraceReader reader;
+  if (!reader.Open(filenames[0])) {
+    fprintf(stderr, "%s is not a trace file\n",
+            filenames[0].toLocal8Bit().constData());
+    return 1;
+  }
+
+  // Sockets live in their own thread, like in the plugin, so this one can
+  // block waiting for replies.
+  QThread io_thread;
+  io_thread.start();
+
+  WorkerPool<WorkerClient>* worker_pool = new WorkerPool<WorkerClient>;
+  worker_pool->moveToThread(&io_thread);
+  worker_pool->SetExecutableName("python");
+  worker_pool->SetExecutableArguments(QStringList() << filenames[1]);
+  worker_pool->SetWorkerCount(1);
+  worker_pool->SetLocalServerName("pyqtc-tracereplay");
+  worker_pool->Start();
+
+  WorkerClient* client = worker_pool->NextHandler();
+
+  QList<WorkerClient::ReplyType*> replies;
+  int request_count = 0;
+  int failed_count = 0;
+
+  QElapsedTimer timer;
+  timer.start();
+
+  qint64 usec = 0;
+  QByteArray data;
+  while (reader.ReadNext(&usec, &data)) {
+    pb::Message message;
+    if (!message.ParseFromArray(data.constData(), data.size())) {
+      fprintf(stderr, "Skipping a message that couldn't be parsed\n");
+      continue;
+    }
+
+    if (realtime) {
+      const qint64 wait_msec = usec / 1000 - timer.elapsed();
+      if (wait_msec > 0) {
+        Sleeper::Msleep(wait_msec);
+      }
+    }
+
+    // Use the timeout the plugin would, so requests that parse a whole
+    // project aren't cut off.
+    WorkerClient::ReplyType* reply = client->SendRequest(
+          &message, WorkerClient::TimeoutForRequest(message));
+    request_count ++;
+
+    if (realtime) {
+      replies << reply;
+    } else {
+      if (!reply->WaitForFinished() ||
+          reply->message().has_error_response()) {
+        failed_count ++;
+      }
+      delete reply;
+    }
+  }
+
+  foreach (WorkerClient::ReplyType* reply, replies) {
+    if (!reply->WaitForFinished() || reply->message().has_error_response()) {
+      failed_count ++;
+    }
+    delete reply;
+  }
+
+  const double elapsed_sec = double(timer.elapsed()) / 1000.0;
+
+  fprintf(stderr, "Replayed %d requests in %.2f seconds "
+                  "(%.1f requests/second), %d failed\n",
+          request_count, elapsed_sec,
+          elapsed_sec > 0 ? request_count / elapsed_sec : 0.0,
+          failed_count);
+
+  if (json) {
+    fputs(WorkerClient::latency_stats()->ToJson().constData(), stdout);
+  } else {
+    fputs(WorkerClient::latency_stats()->ToText().toLocal8Bit().constData(),
+          stdout);
+  }
+
+  // Delete the worker pool in its own thread.  Deferred deletes are processed
+  // when the thread finishes.
+  worker_pool->deleteLater();
+  io_thread.quit();
+  io_thread.wait();
+
+  return failed_count ? 2 : 0;
+}